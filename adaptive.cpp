@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include "tbb/tbb.h"
+#include "adaptive.h"
+#include "brick.h"
+
+const size_t MAX_SPLIT_DEPTH = 48;
+// Number of triangle centroids sampled to find the median of a large cell
+const size_t MEDIAN_SAMPLES = 1 << 16;
+// Cells with more triangles than this are classified against the split in parallel
+const size_t PARALLEL_SPLIT_TRIS = 1 << 16;
+
+// Which children of a split a triangle touches
+const uint8_t SPLIT_LEFT = 1;
+const uint8_t SPLIT_RIGHT = 2;
+
+// Estimate the median centroid of the triangles along the axis from a regular
+// sample of the triangles
+float median_centroid(const mesh_view &mesh, const std::vector<size_t> &tris, const int axis) {
+	const size_t stride = std::max(size_t(1), tris.size() / MEDIAN_SAMPLES);
+	std::vector<float> centroids;
+	centroids.reserve(tris.size() / stride + 1);
+	for (size_t i = 0; i < tris.size(); i += stride) {
+		const std::array<vec3f, 3> tri = mesh.triangle(tris[i]);
+		centroids.push_back((tri[0][axis] + tri[1][axis] + tri[2][axis]) / 3.f);
+	}
+	auto mid = centroids.begin() + centroids.size() / 2;
+	std::nth_element(centroids.begin(), mid, centroids.end());
+	return *mid;
+}
+
+struct adaptive_splitter {
+	const mesh_view &mesh;
+	const adaptive_options &options;
+	tbb::enumerable_thread_specific<sat_counters> counters;
+	tbb::enumerable_thread_specific<vertex_remap_table> vertex_tables;
+
+	adaptive_splitter(const mesh_view &mesh, const adaptive_options &options)
+		: mesh(mesh), options(options)
+	{}
+
+	// Count the distinct vertex indices of the triangles
+	size_t count_verts(const std::vector<size_t> &tris) {
+		vertex_remap_table &table = vertex_tables.local();
+		table.reset(3 * tris.size());
+		size_t num_verts = 0;
+		for (const size_t t : tris) {
+			for (size_t v = 0; v < 3; ++v) {
+				bool inserted = false;
+				table.find_or_insert(mesh.index(3 * t + v), num_verts, inserted);
+				num_verts += inserted ? 1 : 0;
+			}
+		}
+		return num_verts;
+	}
+
+	// Check if a brick of the triangles is within the limits. The vertices are only
+	// counted when the size with every vertex distinct is over the budget, and the
+	// size with no vertices isn't
+	bool within_limits(const std::vector<size_t> &tris) {
+		if (options.max_tris != 0 && tris.size() > options.max_tris) {
+			return false;
+		}
+		if (options.max_bytes == 0) {
+			return true;
+		}
+		const uint64_t ntris = tris.size();
+		if (options.estimate_size(3 * ntris, ntris) <= options.max_bytes) {
+			return true;
+		}
+		if (options.estimate_size(0, ntris) > options.max_bytes) {
+			return false;
+		}
+		return options.estimate_size(count_verts(tris), ntris) <= options.max_bytes;
+	}
+
+	// Find which children of the split at plane each triangle in [begin, end) touches.
+	// Triangles on one side of the plane are only in that child, while those touching
+	// the plane are tested against both children
+	void classify(const std::vector<size_t> &tris, const size_t begin, const size_t end,
+			const int axis, const float plane, const box3f &left, const box3f &right,
+			std::vector<uint8_t> &sides)
+	{
+		sat_counters &c = counters.local();
+		triangle_batch batch;
+		std::array<size_t, TRIANGLE_BATCH_SIZE> batch_slots;
+		auto test_batch = [&]() {
+			const uint32_t in_left = triangle_box_intersection(batch, left, &c);
+			const uint32_t in_right = triangle_box_intersection(batch, right, &c);
+			for (size_t k = 0; k < batch.count; ++k) {
+				uint8_t side = ((in_left >> k) & 1 ? SPLIT_LEFT : 0) | ((in_right >> k) & 1 ? SPLIT_RIGHT : 0);
+				// The triangle touches the parent, so keep it in both children if the
+				// tests disagree with that due to round off
+				sides[batch_slots[k]] = side == 0 ? SPLIT_LEFT | SPLIT_RIGHT : side;
+			}
+			batch.count = 0;
+		};
+		for (size_t i = begin; i < end; ++i) {
+			const std::array<vec3f, 3> tri = mesh.triangle(tris[i]);
+			const float lo = std::min(tri[0][axis], std::min(tri[1][axis], tri[2][axis]));
+			const float hi = std::max(tri[0][axis], std::max(tri[1][axis], tri[2][axis]));
+			if (hi < plane) {
+				sides[i] = SPLIT_LEFT;
+				++c.untested;
+			} else if (lo > plane) {
+				sides[i] = SPLIT_RIGHT;
+				++c.untested;
+			} else {
+				batch_slots[batch.push_back(tri[0], tri[1], tri[2])] = i;
+				if (batch.full()) {
+					test_batch();
+				}
+			}
+		}
+		test_batch();
+	}
+
+	std::vector<adaptive_brick> split(const box3f &bounds, const size_t cell, std::vector<size_t> tris,
+			const size_t depth)
+	{
+		if (tris.empty()) {
+			return std::vector<adaptive_brick>();
+		}
+		if (depth >= MAX_SPLIT_DEPTH || within_limits(tris)) {
+			return std::vector<adaptive_brick>{adaptive_brick{bounds, cell, std::move(tris)}};
+		}
+
+		const vec3f extent = bounds.upper - bounds.lower;
+		int axis = extent.x >= extent.y ? 0 : 1;
+		axis = extent.z > extent[axis] ? 2 : axis;
+		float plane = median_centroid(mesh, tris, axis);
+		if (!(plane > bounds.lower[axis] && plane < bounds.upper[axis])) {
+			plane = 0.5f * (bounds.lower[axis] + bounds.upper[axis]);
+		}
+		box3f left = bounds;
+		box3f right = bounds;
+		left.upper[axis] = plane;
+		right.lower[axis] = plane;
+
+		std::vector<uint8_t> sides(tris.size(), 0);
+		if (tris.size() > PARALLEL_SPLIT_TRIS) {
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, tris.size()),
+				[&](const tbb::blocked_range<size_t> &r) {
+					classify(tris, r.begin(), r.end(), axis, plane, left, right, sides);
+				});
+		} else {
+			classify(tris, 0, tris.size(), axis, plane, left, right, sides);
+		}
+
+		std::vector<size_t> left_tris, right_tris;
+		for (size_t i = 0; i < tris.size(); ++i) {
+			if (sides[i] & SPLIT_LEFT) {
+				left_tris.push_back(tris[i]);
+			}
+			if (sides[i] & SPLIT_RIGHT) {
+				right_tris.push_back(tris[i]);
+			}
+		}
+		// Splitting further won't help if every triangle touches both sides
+		if (left_tris.size() == tris.size() && right_tris.size() == tris.size()) {
+			return std::vector<adaptive_brick>{adaptive_brick{bounds, cell, std::move(tris)}};
+		}
+		std::vector<size_t>().swap(tris);
+		std::vector<uint8_t>().swap(sides);
+
+		std::vector<adaptive_brick> left_bricks, right_bricks;
+		tbb::parallel_invoke(
+			[&]() { left_bricks = split(left, cell, std::move(left_tris), depth + 1); },
+			[&]() { right_bricks = split(right, cell, std::move(right_tris), depth + 1); });
+		left_bricks.insert(left_bricks.end(), std::make_move_iterator(right_bricks.begin()),
+				std::make_move_iterator(right_bricks.end()));
+		return left_bricks;
+	}
+};
+
+bool adaptive_brick::owns(const uniform_grid &grid, const vec3f &p) const {
+	if (grid.cell_containing(p) != cell) {
+		return false;
+	}
+	// The faces shared with the cell are exactly the cell's, while the split
+	// planes are strictly inside it
+	const box3f cell_bounds = grid.cell_bounds(cell);
+	for (int i = 0; i < 3; ++i) {
+		if (bounds.lower[i] != cell_bounds.lower[i] && p[i] < bounds.lower[i]) {
+			return false;
+		}
+		if (bounds.upper[i] != cell_bounds.upper[i] && p[i] >= bounds.upper[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::vector<adaptive_brick> adaptive_partition(const uniform_grid &grid, const mesh_view &mesh,
+		const adaptive_options &options, sat_counters *counters)
+{
+	if (options.max_bytes != 0 && !options.estimate_size) {
+		throw std::runtime_error("Adaptive byte budget given without a brick size estimate");
+	}
+	std::vector<std::vector<size_t>> cell_tris = bin_triangles(grid, mesh, counters);
+
+	adaptive_splitter splitter(mesh, options);
+	std::vector<std::vector<adaptive_brick>> cell_bricks(cell_tris.size());
+	tbb::parallel_for(size_t(0), cell_tris.size(), size_t(1),
+		[&](const size_t i) {
+			cell_bricks[i] = splitter.split(grid.cell_bounds(i), i, std::move(cell_tris[i]), 0);
+		});
+
+	std::vector<adaptive_brick> bricks;
+	for (auto &b : cell_bricks) {
+		bricks.insert(bricks.end(), std::make_move_iterator(b.begin()), std::make_move_iterator(b.end()));
+	}
+	if (counters) {
+		for (const auto &c : splitter.counters) {
+			*counters += c;
+		}
+	}
+	return bricks;
+}
+
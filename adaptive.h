@@ -0,0 +1,45 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "math.h"
+#include "mesh.h"
+#include "grid.h"
+
+// A brick of an adaptive partition of the mesh and the IDs of the triangles touching it
+struct adaptive_brick {
+	box3f bounds;
+	// The grid cell the brick was split from
+	size_t cell = 0;
+	std::vector<size_t> tris;
+
+	// Check if the brick owns the point. The point must be in the brick's cell, and
+	// within the brick's bounds on the faces made by splitting the cell, where each
+	// point on a split plane is owned by the brick above the plane. Each point is
+	// owned by exactly one brick of the partition, unless it's in an empty brick
+	bool owns(const uniform_grid &grid, const vec3f &p) const;
+};
+
+// Estimates the encoded size in bytes of a brick with the given vertex and triangle counts
+using brick_size_estimate = std::function<uint64_t(uint64_t num_verts, uint64_t num_tris)>;
+
+struct adaptive_options {
+	// Split bricks with more than max_tris triangles, 0 for no limit
+	size_t max_tris = 0;
+	// Split bricks whose estimated encoded size is more than max_bytes, 0 for no limit.
+	// Requires estimate_size
+	uint64_t max_bytes = 0;
+	brick_size_estimate estimate_size;
+};
+
+// Partition the mesh into bricks within the triangle and size limits of the options.
+// Each cell of the grid is split k-d tree style, at the median triangle centroid along
+// its longest axis, until it's within the limits. A brick's size is estimated from its
+// triangle count and number of distinct vertex indices, so vertices welded when the
+// brick is built only make it smaller. Triangles touching both sides of a split
+// are kept in both children, so a cell whose split doesn't reduce the triangle count
+// on either side is kept as a single brick, as is any cell at the maximum depth.
+// Empty bricks are dropped. The bricks are returned in grid cell order, with each
+// cell's bricks in depth first order, and each brick's triangles sorted by ID.
+std::vector<adaptive_brick> adaptive_partition(const uniform_grid &grid, const mesh_view &mesh,
+		const adaptive_options &options, sat_counters *counters = nullptr);
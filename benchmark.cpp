@@ -0,0 +1,385 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include "tbb/tbb.h"
+
+#include "math.h"
+#include "mesh.h"
+#include "obj_parser.h"
+#include "grid.h"
+#include "brick.h"
+#include "brick_writer.h"
+#include "file_io.h"
+#include "stats.h"
+
+struct synthetic_mesh {
+	std::vector<float> verts;
+	std::vector<uint64_t> indices;
+};
+
+// Append a UV sphere with nrings rings of 2 * nrings segments each, giving about
+// 4 * nrings^2 triangles. The radius at each vertex is scaled by displace(dir)
+void append_sphere(synthetic_mesh &mesh, const vec3f &center, const float radius, const size_t nrings,
+		const std::function<float(const vec3f&)> &displace)
+{
+	const size_t nsegments = 2 * nrings;
+	const uint64_t first_vert = mesh.verts.size() / 3;
+	for (size_t i = 0; i <= nrings; ++i) {
+		const float theta = M_PI * i / nrings;
+		for (size_t j = 0; j < nsegments; ++j) {
+			const float phi = 2.0 * M_PI * j / nsegments;
+			const vec3f dir(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi),
+					std::cos(theta));
+			const vec3f p = center + dir * (radius * displace(dir));
+			mesh.verts.push_back(p.x);
+			mesh.verts.push_back(p.y);
+			mesh.verts.push_back(p.z);
+		}
+	}
+	for (size_t i = 0; i < nrings; ++i) {
+		for (size_t j = 0; j < nsegments; ++j) {
+			const uint64_t a = first_vert + i * nsegments + j;
+			const uint64_t b = first_vert + i * nsegments + (j + 1) % nsegments;
+			const uint64_t c = a + nsegments;
+			const uint64_t d = b + nsegments;
+			for (const uint64_t v : {a, c, b, b, c, d}) {
+				mesh.indices.push_back(v);
+			}
+		}
+	}
+}
+
+size_t rings_for_triangles(const size_t ntris) {
+	return std::max(size_t(2), static_cast<size_t>(std::sqrt(ntris / 4.0)));
+}
+
+// A tessellated unit sphere
+synthetic_mesh generate_sphere(const size_t ntris, std::mt19937 &) {
+	synthetic_mesh mesh;
+	append_sphere(mesh, vec3f(0), 1.f, rings_for_triangles(ntris), [](const vec3f &) { return 1.f; });
+	return mesh;
+}
+
+// A sphere displaced by a sum of random sinusoids, similar to a noisy isosurface
+synthetic_mesh generate_noisy(const size_t ntris, std::mt19937 &rng) {
+	const size_t noctaves = 8;
+	std::uniform_real_distribution<float> unif(-1.f, 1.f);
+	std::vector<vec3f> freqs;
+	std::vector<float> phases;
+	for (size_t i = 0; i < noctaves; ++i) {
+		freqs.push_back(vec3f(unif(rng), unif(rng), unif(rng)) * float(4 << i));
+		phases.push_back(unif(rng) * M_PI);
+	}
+	synthetic_mesh mesh;
+	append_sphere(mesh, vec3f(0), 1.f, rings_for_triangles(ntris),
+		[&](const vec3f &dir) {
+			float d = 0.f;
+			for (size_t i = 0; i < noctaves; ++i) {
+				d += std::sin(dot(freqs[i], dir) + phases[i]) / (2 << i);
+			}
+			return 1.f + 0.2f * d;
+		});
+	return mesh;
+}
+
+// A sparse sphere holding a tenth of the triangles, with the rest in small
+// spheres packed into a few dense clusters
+synthetic_mesh generate_clustered(const size_t ntris, std::mt19937 &rng) {
+	const size_t nclusters = 16;
+	const size_t tris_per_small_sphere = 1024;
+	synthetic_mesh mesh;
+	auto no_displacement = [](const vec3f &) { return 1.f; };
+	append_sphere(mesh, vec3f(0), 1.f, rings_for_triangles(ntris / 10), no_displacement);
+
+	std::uniform_real_distribution<float> unif(-0.7f, 0.7f);
+	std::normal_distribution<float> offset(0.f, 0.02f);
+	std::vector<vec3f> clusters;
+	for (size_t i = 0; i < nclusters; ++i) {
+		clusters.push_back(vec3f(unif(rng), unif(rng), unif(rng)));
+	}
+	const size_t nsmall = std::max(size_t(1), (ntris - ntris / 10) / tris_per_small_sphere);
+	for (size_t i = 0; i < nsmall; ++i) {
+		const vec3f center = clusters[i % nclusters] + vec3f(offset(rng), offset(rng), offset(rng));
+		append_sphere(mesh, center, 0.01f, rings_for_triangles(tris_per_small_sphere), no_displacement);
+	}
+	return mesh;
+}
+
+void write_bobj(const synthetic_mesh &mesh, const std::string &fname) {
+	std::ofstream fout(fname.c_str(), std::ios::binary);
+	const uint64_t header[2] = {mesh.verts.size() / 3, mesh.indices.size() / 3};
+	fout.write(reinterpret_cast<const char*>(header), sizeof(header));
+	fout.write(reinterpret_cast<const char*>(mesh.verts.data()), sizeof(float) * mesh.verts.size());
+	fout.write(reinterpret_cast<const char*>(mesh.indices.data()),
+			sizeof(uint64_t) * mesh.indices.size());
+}
+
+// Parse a count like 500K, 10M or 1G
+size_t parse_count(const std::string &s) {
+	size_t scale = 1;
+	switch (s.back()) {
+		case 'K': case 'k': scale = 1000; break;
+		case 'M': case 'm': scale = 1000000; break;
+		case 'G': case 'g': scale = 1000000000; break;
+		default: break;
+	}
+	return static_cast<size_t>(std::atof(s.c_str()) * scale);
+}
+
+std::vector<std::string> split(const std::string &s, const char sep) {
+	std::vector<std::string> parts;
+	std::stringstream ss(s);
+	std::string part;
+	while (std::getline(ss, part, sep)) {
+		parts.push_back(part);
+	}
+	return parts;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || std::strcmp(argv[1], "-h") == 0) {
+		std::cout << "Usage: " << argv[0] << " <scratch dir> [options]\n"
+			<< "    Generates synthetic meshes in <scratch dir> and times each stage of the\n"
+			<< "    gridder on them, printing the results as JSON.\n"
+			<< "Options:\n"
+			<< "    -meshes <list>     Comma separated list of sphere, noisy and clustered meshes\n"
+			<< "                       to run (default: sphere,noisy,clustered)\n"
+			<< "    -tris <list>       Comma separated triangle counts, e.g. 1M,10M,500M (default: 1M)\n"
+			<< "    -grid <x> <y> <z>  Grid dimensions (default: 16 16 16)\n"
+			<< "    -seed <n>          Random seed for the generators (default: 1)\n"
+			<< "    -obj               Also time parsing and writing text OBJ files\n"
+			<< "    -o <file.json>     Write the results to a file instead of stdout\n";
+		return 1;
+	}
+	const std::string scratch_dir = argv[1];
+	std::vector<std::string> mesh_types{"sphere", "noisy", "clustered"};
+	std::vector<size_t> tri_counts{1000000};
+	vec3sz grid_dims(16, 16, 16);
+	unsigned int seed = 1;
+	bool text_obj = false;
+	std::string output;
+	for (int i = 2; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-meshes") == 0 && i + 1 < argc) {
+			mesh_types = split(argv[++i], ',');
+		} else if (std::strcmp(argv[i], "-tris") == 0 && i + 1 < argc) {
+			tri_counts.clear();
+			for (const auto &c : split(argv[++i], ',')) {
+				tri_counts.push_back(parse_count(c));
+			}
+		} else if (std::strcmp(argv[i], "-grid") == 0 && i + 3 < argc) {
+			grid_dims.x = std::atoll(argv[++i]);
+			grid_dims.y = std::atoll(argv[++i]);
+			grid_dims.z = std::atoll(argv[++i]);
+		} else if (std::strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+			seed = std::atoi(argv[++i]);
+		} else if (std::strcmp(argv[i], "-obj") == 0) {
+			text_obj = true;
+		} else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		} else {
+			std::cout << "Error: unrecognized option " << argv[i] << "\n";
+			return 1;
+		}
+	}
+
+	for (const auto &type : mesh_types) {
+		if (type != "sphere" && type != "noisy" && type != "clustered") {
+			std::cout << "Error: unknown mesh type " << type << "\n";
+			return 1;
+		}
+	}
+
+	std::stringstream json;
+	json << "{\n\t\"threads\": " << tbb::this_task_arena::max_concurrency()
+		<< ",\n\t\"grid\": [" << grid_dims.x << ", " << grid_dims.y << ", " << grid_dims.z << "]"
+		<< ",\n\t\"seed\": " << seed
+		<< ",\n\t\"results\": [";
+	bool first_result = true;
+	for (const auto &type : mesh_types) {
+		for (const auto &ntris : tri_counts) {
+			std::vector<std::pair<std::string, double>> stages;
+			std::mt19937 rng(seed);
+			synthetic_mesh generated;
+			stages.emplace_back("generate", time_stage([&]() {
+				if (type == "sphere") {
+					generated = generate_sphere(ntris, rng);
+				} else if (type == "noisy") {
+					generated = generate_noisy(ntris, rng);
+				} else {
+					generated = generate_clustered(ntris, rng);
+				}
+			}));
+			const std::string mesh_file = scratch_dir + "/bench_" + type + "_" + std::to_string(ntris);
+			write_bobj(generated, mesh_file + ".bobj");
+			const size_t num_verts = generated.verts.size() / 3;
+			const size_t num_tris = generated.indices.size() / 3;
+			std::cerr << "Running " << type << " with " << num_tris << " triangles\n";
+			if (text_obj) {
+				brick_writer writer;
+				mesh_brick brick;
+				for (size_t i = 0; i < num_verts; ++i) {
+					brick.verts.push_back(vec3f(generated.verts[3 * i], generated.verts[3 * i + 1],
+								generated.verts[3 * i + 2]));
+				}
+				brick.indices = generated.indices;
+				writer.write_obj(brick, mesh_file + ".obj");
+			}
+			generated = synthetic_mesh();
+
+			std::unique_ptr<bobj_file> bobj;
+			stages.emplace_back("load", time_stage([&]() {
+				bobj = std::make_unique<bobj_file>(mesh_file + ".bobj");
+			}));
+			if (text_obj) {
+				std::vector<float> obj_verts;
+				std::vector<uint64_t> obj_indices;
+				stages.emplace_back("load_obj", time_stage([&]() {
+					load_obj(mesh_file + ".obj", obj_verts, obj_indices);
+				}));
+			}
+			const mesh_view mesh = bobj->mesh;
+
+			box3f bounds;
+			stages.emplace_back("bounds", time_stage([&]() {
+				bounds = mesh_bounds(mesh, 0, mesh.num_verts);
+			}));
+			const uniform_grid grid(grid_dims, bounds);
+
+			std::vector<std::vector<size_t>> cell_tris;
+			stages.emplace_back("binning", time_stage([&]() {
+				cell_tris = bin_triangles(grid, mesh);
+			}));
+
+			// Time the SAT kernels alone on the tests binning runs, each triangle whose
+			// bounds span more than one cell against each of the cells they overlap
+			std::vector<std::vector<size_t>> cell_candidates(grid.num_cells());
+			for (size_t f = 0; f < mesh.num_tris; ++f) {
+				const std::array<vec3f, 3> tri = mesh.triangle(f);
+				box3f tri_bounds;
+				for (const auto &p : tri) {
+					tri_bounds.extend(p);
+				}
+				vec3sz lo, hi;
+				grid.overlapped_cells(tri_bounds, lo, hi);
+				if (lo == hi) {
+					continue;
+				}
+				for (size_t z = lo.z; z <= hi.z; ++z) {
+					for (size_t y = lo.y; y <= hi.y; ++y) {
+						for (size_t x = lo.x; x <= hi.x; ++x) {
+							cell_candidates[grid.cell_id(vec3sz(x, y, z))].push_back(f);
+						}
+					}
+				}
+			}
+			auto time_sat = [&](const std::string &stage,
+					const std::function<size_t(const std::vector<size_t>&, const box3f&)> &test)
+			{
+				size_t hits = 0;
+				stages.emplace_back(stage, time_stage([&]() {
+					hits = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, grid.num_cells(), 1), size_t(0),
+						[&](const tbb::blocked_range<size_t> &r, size_t count) {
+							for (size_t i = r.begin(); i != r.end(); ++i) {
+								count += test(cell_candidates[i], grid.cell_bounds(i));
+							}
+							return count;
+						}, std::plus<size_t>());
+				}));
+				return hits;
+			};
+			const size_t scalar_hits = time_sat("sat_scalar",
+				[&](const std::vector<size_t> &tris, const box3f &cell) {
+					size_t hits = 0;
+					for (const auto &f : tris) {
+						const std::array<vec3f, 3> tri = mesh.triangle(f);
+						hits += triangle_box_intersection(tri[0], tri[1], tri[2], cell) ? 1 : 0;
+					}
+					return hits;
+				});
+			const size_t batched_hits = time_sat("sat_batched",
+				[&](const std::vector<size_t> &tris, const box3f &cell) {
+					size_t hits = 0;
+					triangle_batch batch;
+					for (size_t j = 0; j < tris.size(); ++j) {
+						const std::array<vec3f, 3> tri = mesh.triangle(tris[j]);
+						batch.push_back(tri[0], tri[1], tri[2]);
+						if (batch.full() || j + 1 == tris.size()) {
+							hits += __builtin_popcount(triangle_box_intersection(batch, cell));
+							batch.count = 0;
+						}
+					}
+					return hits;
+				});
+			std::vector<std::vector<size_t>>().swap(cell_candidates);
+			if (scalar_hits != batched_hits) {
+				std::cerr << "Warning: scalar and batched SAT tests disagree ("
+					<< scalar_hits << " vs. " << batched_hits << ")\n";
+			}
+
+			tbb::enumerable_thread_specific<brick_builder> builders;
+			const double remap_time = time_stage([&]() {
+				tbb::parallel_for(size_t(0), grid.num_cells(), size_t(1),
+					[&](const size_t i) {
+						builders.local().build(mesh, cell_tris[i], -1.f);
+					});
+			});
+			stages.emplace_back("remap", remap_time);
+
+			// Writing is timed as building and writing the bricks, less the remap time
+			tbb::enumerable_thread_specific<brick_writer> writers;
+			const std::string brick_prefix = scratch_dir + "/bench_brick";
+			stages.emplace_back("write", time_stage([&]() {
+				tbb::parallel_for(size_t(0), grid.num_cells(), size_t(1),
+					[&](const size_t i) {
+						const mesh_brick &brick = builders.local().build(mesh, cell_tris[i], -1.f);
+						writers.local().write_bobj(brick, brick_prefix + std::to_string(i) + ".bobj");
+					});
+			}) - remap_time);
+			if (text_obj) {
+				stages.emplace_back("write_obj", time_stage([&]() {
+					tbb::parallel_for(size_t(0), grid.num_cells(), size_t(1),
+						[&](const size_t i) {
+							const mesh_brick &brick = builders.local().build(mesh, cell_tris[i], -1.f);
+							writers.local().write_obj(brick, brick_prefix + std::to_string(i) + ".obj");
+						});
+				}) - remap_time);
+			}
+
+			size_t binned_tris = 0;
+			for (const auto &tris : cell_tris) {
+				binned_tris += tris.size();
+			}
+
+			json << (first_result ? "" : ",") << "\n\t\t{\n"
+				<< "\t\t\t\"mesh\": \"" << type << "\",\n"
+				<< "\t\t\t\"requested_triangles\": " << ntris << ",\n"
+				<< "\t\t\t\"triangles\": " << num_tris << ",\n"
+				<< "\t\t\t\"vertices\": " << num_verts << ",\n"
+				<< "\t\t\t\"binned_triangles\": " << binned_tris << ",\n"
+				<< "\t\t\t\"stages\": {";
+			for (size_t i = 0; i < stages.size(); ++i) {
+				json << (i == 0 ? "" : ",") << "\n\t\t\t\t\"" << stages[i].first << "\": "
+					<< stages[i].second;
+			}
+			json << "\n\t\t\t}\n\t\t}";
+			first_result = false;
+		}
+	}
+	json << "\n\t]\n}\n";
+
+	if (output.empty()) {
+		std::cout << json.str();
+	} else {
+		std::ofstream fout(output.c_str());
+		fout << json.str();
+	}
+	return 0;
+}
+
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include "math.h"
+
+// The .bobj binary mesh format. The original (version 1) layout has no magic number:
+// a header of the uint64 vertex and triangle counts, followed by the float xyz vertex
+// positions and the uint64 triangle indices.
+//
+// Version 2 files start with a bobj_header and store the indices with the smallest
+// width that can index all the vertices. The vertices are either float xyz positions,
+// or quantized to quant_bits per component relative to the bounds in the header and
+// stored as uint16 xyz. The vertex array is padded with zeros to a multiple of 8 bytes
+// so the index array is aligned. All values are little endian.
+const char BOBJ_MAGIC[4] = {'B', 'O', 'B', 'J'};
+const uint16_t BOBJ_VERSION = 2;
+
+// Set if the header's bounds hold the bounds of the vertices
+const uint8_t BOBJ_HAS_BOUNDS = 1;
+// Set if the vertices are quantized to quant_bits per component
+const uint8_t BOBJ_QUANTIZED = 2;
+
+// Set if the vertices and indices are compressed. The header is followed by a
+// bobj_streams table of the sizes of the compressed streams, then the streams: the
+// x, y and z vertex components as separate planes followed by the indices, each
+// coded with delta_vbyte_encode. The vertex components are coded as the bits of
+// their float value, or their quantized value if quantized. The indices are coded
+// as uint32, and index_bytes is 4.
+const uint8_t BOBJ_COMPRESSED = 4;
+
+// Set if num_owned_tris holds the number of triangles owned by the brick. The owned
+// triangles come first, the rest are ghost triangles owned by neighboring bricks.
+const uint8_t BOBJ_HAS_OWNERSHIP = 8;
+
+const uint32_t BOBJ_MAX_QUANT_BITS = 16;
+
+struct bobj_header {
+	char magic[4];
+	uint16_t version;
+	// Width of each index in bytes, 2, 4 or 8
+	uint8_t index_bytes;
+	uint8_t flags;
+	uint8_t quant_bits;
+	uint8_t reserved[7];
+	uint64_t num_verts;
+	uint64_t num_tris;
+	float lower[3];
+	float upper[3];
+	uint64_t num_owned_tris;
+};
+static_assert(sizeof(bobj_header) == 64, "bobj_header must be 64 bytes");
+
+// Sizes in bytes of the x, y, z vertex and index streams of a compressed file
+struct bobj_streams {
+	uint64_t bytes[4];
+};
+
+// Get the smallest index width in bytes which can index num_verts vertices
+inline uint8_t bobj_index_bytes(const uint64_t num_verts) {
+	if (num_verts <= uint64_t(1) << 16) {
+		return 2;
+	}
+	if (num_verts <= uint64_t(1) << 32) {
+		return 4;
+	}
+	return 8;
+}
+
+// Size of the vertex array of a version 2 file in bytes, including the padding
+inline uint64_t bobj_verts_bytes(const uint64_t num_verts, const bool quantized) {
+	const uint64_t bytes = num_verts * 3 * (quantized ? sizeof(uint16_t) : sizeof(float));
+	return (bytes + 7) & ~uint64_t(7);
+}
+
@@ -0,0 +1,156 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "brick.h"
+
+const uint64_t EMPTY_KEY = std::numeric_limits<uint64_t>::max();
+
+uint64_t hash_u64(uint64_t x) {
+	// Murmur3's 64 bit finalizer
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// Find the power of two table size needed to hold n entries at a load factor of 1/2
+size_t table_capacity(const size_t n) {
+	size_t capacity = 64;
+	while (capacity < 2 * n) {
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+size_t mesh_brick::num_tris() const {
+	return indices.size() / 3;
+}
+void mesh_brick::clear() {
+	verts.clear();
+	indices.clear();
+	num_owned = 0;
+}
+
+void vertex_remap_table::reset(const size_t n) {
+	const size_t capacity = table_capacity(n);
+	if (capacity > keys.size()) {
+		keys.assign(capacity, EMPTY_KEY);
+		values.resize(capacity);
+	} else {
+		for (const auto &s : used_slots) {
+			keys[s] = EMPTY_KEY;
+		}
+	}
+	used_slots.clear();
+	mask = capacity - 1;
+}
+uint64_t& vertex_remap_table::find_or_insert(const uint64_t key, const uint64_t value,
+		bool &inserted)
+{
+	size_t s = hash_u64(key) & mask;
+	while (keys[s] != EMPTY_KEY) {
+		if (keys[s] == key) {
+			inserted = false;
+			return values[s];
+		}
+		s = (s + 1) & mask;
+	}
+	keys[s] = key;
+	values[s] = value;
+	used_slots.push_back(s);
+	inserted = true;
+	return values[s];
+}
+
+position_weld_table::position_weld_table() : mask(0), epsilon(0.f) {}
+std::array<int64_t, 3> position_weld_table::cell(const vec3f &p) const {
+	if (epsilon == 0.f) {
+		// Adding 0 turns -0 into 0 so they hash the same
+		const std::array<float, 3> v{p.x + 0.f, p.y + 0.f, p.z + 0.f};
+		std::array<int32_t, 3> bits;
+		std::memcpy(bits.data(), v.data(), sizeof(bits));
+		return std::array<int64_t, 3>{bits[0], bits[1], bits[2]};
+	}
+	return std::array<int64_t, 3>{
+		static_cast<int64_t>(std::floor(p.x / epsilon)),
+		static_cast<int64_t>(std::floor(p.y / epsilon)),
+		static_cast<int64_t>(std::floor(p.z / epsilon))
+	};
+}
+size_t position_weld_table::slot(const std::array<int64_t, 3> &c) const {
+	uint64_t h = hash_u64(c[0]);
+	h = hash_u64(h ^ c[1]);
+	h = hash_u64(h ^ c[2]);
+	return h & mask;
+}
+void position_weld_table::reset(const size_t n, const float eps) {
+	const size_t capacity = table_capacity(n);
+	if (capacity > entries.size()) {
+		entries.resize(capacity);
+		occupied.assign(capacity, 0);
+	} else {
+		for (const auto &s : used_slots) {
+			occupied[s] = 0;
+		}
+	}
+	used_slots.clear();
+	mask = capacity - 1;
+	epsilon = eps;
+}
+uint64_t position_weld_table::find_or_insert(const vec3f &pos, const uint64_t value) {
+	const std::array<int64_t, 3> c = cell(pos);
+	if (epsilon == 0.f) {
+		size_t s = slot(c);
+		for (; occupied[s]; s = (s + 1) & mask) {
+			if (entries[s].cell == c) {
+				return entries[s].value;
+			}
+		}
+		occupied[s] = 1;
+		entries[s] = entry{c, pos, value};
+		used_slots.push_back(s);
+		return value;
+	}
+
+	// Several vertices can share a cell, so each cell's entries are found by
+	// probing until an empty slot
+	const float eps_sqr = epsilon * epsilon;
+	uint64_t found = EMPTY_KEY;
+	for (int64_t z = -1; z <= 1; ++z) {
+		for (int64_t y = -1; y <= 1; ++y) {
+			for (int64_t x = -1; x <= 1; ++x) {
+				const std::array<int64_t, 3> nc{c[0] + x, c[1] + y, c[2] + z};
+				for (size_t s = slot(nc); occupied[s]; s = (s + 1) & mask) {
+					const entry &e = entries[s];
+					const vec3f d = e.pos - pos;
+					if (e.cell == nc && e.value < found && dot(d, d) <= eps_sqr) {
+						found = e.value;
+					}
+				}
+			}
+		}
+	}
+	if (found != EMPTY_KEY) {
+		return found;
+	}
+	size_t s = slot(c);
+	while (occupied[s]) {
+		s = (s + 1) & mask;
+	}
+	occupied[s] = 1;
+	entries[s] = entry{c, pos, value};
+	used_slots.push_back(s);
+	return value;
+}
+
+const mesh_brick& brick_builder::build(const mesh_view &mesh, const std::vector<size_t> &tris,
+		const float weld_epsilon, const centroid_owner &owned)
+{
+	return build(tris.size(),
+		[&](const size_t t, const size_t v) { return mesh.index(3 * tris[t] + v); },
+		[&](const size_t t, const size_t v) { return mesh.vertex(mesh.index(3 * tris[t] + v)); },
+		weld_epsilon, owned);
+}
+
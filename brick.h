@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+#include "mesh.h"
+
+// A brick's triangles, with the vertices remapped into the brick's local vertex space
+struct mesh_brick {
+	std::vector<vec3f> verts;
+	std::vector<uint64_t> indices;
+	// The first num_owned triangles are owned by the brick, the rest are ghosts
+	// owned by another brick which are also included in this one
+	uint64_t num_owned = 0;
+
+	size_t num_tris() const;
+	void clear();
+};
+
+// An open addressing hash table mapping source vertex ids to brick local ids. Clearing
+// the table only touches the slots used since the last clear, so a table can be reused
+// across many bricks without paying for its full capacity each time.
+class vertex_remap_table {
+	std::vector<uint64_t> keys;
+	std::vector<uint64_t> values;
+	std::vector<size_t> used_slots;
+	size_t mask = 0;
+
+public:
+	// Clear the table and make sure it has room for n entries
+	void reset(const size_t n);
+	// Find the value for key, or insert the key with the value if it's not present.
+	// Returns a reference to the value mapped to the key, which stays valid until
+	// the next reset
+	uint64_t& find_or_insert(const uint64_t key, const uint64_t value, bool &inserted);
+};
+
+// Welds vertices by position, a vertex is welded to the first vertex inserted
+// within epsilon of it. Positions are hashed by the epsilon sized grid cell they
+// fall in and the neighboring cells are searched for a match. With an epsilon of 0
+// only vertices with exactly the same position are welded.
+class position_weld_table {
+	struct entry {
+		std::array<int64_t, 3> cell;
+		vec3f pos;
+		uint64_t value;
+	};
+	std::vector<entry> entries;
+	std::vector<uint8_t> occupied;
+	std::vector<size_t> used_slots;
+	size_t mask;
+	float epsilon;
+
+	std::array<int64_t, 3> cell(const vec3f &p) const;
+	size_t slot(const std::array<int64_t, 3> &c) const;
+
+public:
+	position_weld_table();
+	// Clear the table and make sure it has room for n entries
+	void reset(const size_t n, const float eps);
+	// Find the value of a vertex within epsilon of pos, or insert pos with the value
+	// if there is none. Returns the value of the vertex pos was welded to
+	uint64_t find_or_insert(const vec3f &pos, const uint64_t value);
+};
+
+// Returns true if the brick owns the triangle with the given centroid. Each triangle
+// must be owned by exactly one of the bricks it's written to
+using centroid_owner = std::function<bool(const vec3f&)>;
+
+// Builds bricks from a list of the source mesh's triangles. A builder keeps its
+// tables and buffers between bricks, so each thread should reuse its own builder
+struct brick_builder {
+	vertex_remap_table remap;
+	position_weld_table weld;
+	std::vector<size_t> order;
+	std::vector<size_t> ghosts;
+	mesh_brick brick;
+
+	// Gather the triangles into the brick, numbering the vertices in the order they're
+	// first referenced. If weld_epsilon is not negative vertices within weld_epsilon
+	// of each other are also welded together. If owned is set the triangles it owns
+	// are gathered first, otherwise all the triangles are treated as owned
+	const mesh_brick& build(const mesh_view &mesh, const std::vector<size_t> &tris,
+			const float weld_epsilon, const centroid_owner &owned = nullptr);
+
+	// Gather ntris triangles into the brick, where vertex_id(t, v) and position(t, v)
+	// give the source vertex id and position of vertex v of triangle t
+	template<typename I, typename P>
+	const mesh_brick& build(const size_t ntris, const I &vertex_id, const P &position,
+			const float weld_epsilon, const centroid_owner &owned = nullptr);
+};
+
+template<typename I, typename P>
+const mesh_brick& brick_builder::build(const size_t ntris, const I &vertex_id, const P &position,
+		const float weld_epsilon, const centroid_owner &owned)
+{
+	const bool welding = weld_epsilon >= 0.f;
+	brick.clear();
+	brick.indices.reserve(3 * ntris);
+	remap.reset(3 * ntris);
+	if (welding) {
+		weld.reset(3 * ntris, weld_epsilon);
+	}
+	// Ownership is decided on the source positions, before any welding, so
+	// every brick sharing a triangle agrees on its owner
+	brick.num_owned = ntris;
+	if (owned) {
+		order.clear();
+		ghosts.clear();
+		for (size_t t = 0; t < ntris; ++t) {
+			const vec3f centroid = (position(t, 0) + position(t, 1) + position(t, 2)) * (1.f / 3.f);
+			if (owned(centroid)) {
+				order.push_back(t);
+			} else {
+				ghosts.push_back(t);
+			}
+		}
+		brick.num_owned = order.size();
+		order.insert(order.end(), ghosts.begin(), ghosts.end());
+	}
+	for (size_t k = 0; k < ntris; ++k) {
+		const size_t t = owned ? order[k] : k;
+		for (size_t v = 0; v < 3; ++v) {
+			bool inserted = false;
+			uint64_t &id = remap.find_or_insert(vertex_id(t, v), brick.verts.size(), inserted);
+			if (inserted) {
+				const vec3f pos = position(t, v);
+				if (welding) {
+					id = weld.find_or_insert(pos, brick.verts.size());
+				}
+				if (id == brick.verts.size()) {
+					brick.verts.push_back(pos);
+				}
+			}
+			brick.indices.push_back(id);
+		}
+	}
+	return brick;
+}
+
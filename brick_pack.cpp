@@ -0,0 +1,99 @@
+#include <cstring>
+#include <stdexcept>
+#include "brick_pack.h"
+
+// Alignment of the bricks in the pack when not using direct I/O
+const uint64_t BRICK_PACK_ALIGNMENT = 64;
+
+uint64_t align_up(const uint64_t x, const uint64_t alignment) {
+	return ((x + alignment - 1) / alignment) * alignment;
+}
+
+brick_pack_writer::brick_pack_writer(const std::string &fname, const pack_format format,
+		const size_t num_bricks, const bool direct_io)
+	: file(fname, direct_io), entries(num_bricks, pack_entry{})
+{
+	std::memcpy(header.magic, BRICK_PACK_MAGIC, sizeof(BRICK_PACK_MAGIC));
+	header.version = BRICK_PACK_VERSION;
+	header.format = static_cast<uint32_t>(format);
+	header.num_bricks = num_bricks;
+	// Direct writes must start on an aligned offset
+	header.alignment = file.direct() ? DIRECT_IO_ALIGNMENT : BRICK_PACK_ALIGNMENT;
+	data_end = align_up(sizeof(pack_header) + sizeof(pack_entry) * num_bricks, header.alignment);
+}
+size_t brick_pack_writer::write(const size_t id, const box3f &bounds, const uint64_t num_tris,
+		aligned_buffer &data)
+{
+	pack_entry &e = entries[id];
+	e.size = data.size();
+	e.num_tris = num_tris;
+	e.lower[0] = bounds.lower.x;
+	e.lower[1] = bounds.lower.y;
+	e.lower[2] = bounds.lower.z;
+	e.upper[0] = bounds.upper.x;
+	e.upper[1] = bounds.upper.y;
+	e.upper[2] = bounds.upper.z;
+	if (data.size() == 0) {
+		return 0;
+	}
+	e.offset = data_end.fetch_add(align_up(data.size(), header.alignment));
+	if (file.direct()) {
+		file.write_padded(data, e.offset);
+	} else {
+		file.write(data.data(), data.size(), e.offset);
+	}
+	return data.size();
+}
+void brick_pack_writer::finish() {
+	file.write(reinterpret_cast<const char*>(&header), sizeof(pack_header), 0);
+	file.write(reinterpret_cast<const char*>(entries.data()), sizeof(pack_entry) * entries.size(),
+			sizeof(pack_header));
+	file.truncate(data_end);
+}
+
+brick_pack::brick_pack(const std::string &fname)
+	: file(fname), header(nullptr), entries(nullptr)
+{
+	if (file.size() < sizeof(pack_header)) {
+		throw std::runtime_error("Invalid brick pack " + fname + ": file is truncated");
+	}
+	header = reinterpret_cast<const pack_header*>(file.data());
+	if (std::memcmp(header->magic, BRICK_PACK_MAGIC, sizeof(BRICK_PACK_MAGIC)) != 0) {
+		throw std::runtime_error("Invalid brick pack " + fname + ": bad magic number");
+	}
+	if (header->version != BRICK_PACK_VERSION) {
+		throw std::runtime_error("Unsupported brick pack version " + std::to_string(header->version)
+				+ " in " + fname);
+	}
+	if (header->format != static_cast<uint32_t>(pack_format::BOBJ)
+			&& header->format != static_cast<uint32_t>(pack_format::OBJ))
+	{
+		throw std::runtime_error("Unsupported brick format " + std::to_string(header->format)
+				+ " in brick pack " + fname);
+	}
+	if (header->num_bricks > file.size() / sizeof(pack_entry)
+			|| sizeof(pack_header) + sizeof(pack_entry) * header->num_bricks > file.size())
+	{
+		throw std::runtime_error("Invalid brick pack " + fname + ": file is truncated");
+	}
+	entries = reinterpret_cast<const pack_entry*>(file.data() + sizeof(pack_header));
+	for (size_t i = 0; i < header->num_bricks; ++i) {
+		if (entries[i].offset > file.size() || entries[i].size > file.size() - entries[i].offset) {
+			throw std::runtime_error("Invalid brick pack " + fname + ": brick "
+					+ std::to_string(i) + " is past the end of the file");
+		}
+	}
+}
+pack_format brick_pack::format() const {
+	return static_cast<pack_format>(header->format);
+}
+size_t brick_pack::num_bricks() const {
+	return header->num_bricks;
+}
+const pack_entry& brick_pack::entry(const size_t id) const {
+	return entries[id];
+}
+const char* brick_pack::brick_data(const size_t id) const {
+	return file.data() + entries[id].offset;
+}
+
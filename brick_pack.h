@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+#include "file_io.h"
+
+// A brick pack stores all the bricks of a gridded mesh in a single file. The file
+// starts with a pack_header, followed by a table of one pack_entry per brick indexed
+// by brick id, followed by the brick data. Each brick is stored as the contents of
+// its .bobj or OBJ file, at the offset and size given by its entry. Empty bricks
+// have a size of 0. All values are little endian.
+const char BRICK_PACK_MAGIC[8] = {'B', 'R', 'I', 'C', 'K', 'P', 'A', 'K'};
+const uint32_t BRICK_PACK_VERSION = 1;
+
+enum class pack_format : uint32_t {
+	BOBJ = 0,
+	OBJ = 1,
+};
+
+struct pack_header {
+	char magic[8];
+	uint32_t version;
+	// The pack_format of the bricks
+	uint32_t format;
+	uint64_t num_bricks;
+	// Alignment of the start of each brick's data in the file
+	uint64_t alignment;
+};
+static_assert(sizeof(pack_header) == 32, "pack_header must be 32 bytes");
+static_assert(std::is_standard_layout<pack_header>::value, "pack_header is written to disk as is");
+
+struct pack_entry {
+	uint64_t offset;
+	uint64_t size;
+	uint64_t num_tris;
+	float lower[3];
+	float upper[3];
+};
+static_assert(sizeof(pack_entry) == 48, "pack_entry must be 48 bytes");
+static_assert(std::is_standard_layout<pack_entry>::value, "pack_entry is written to disk as is");
+
+// Writes bricks into a pack. Bricks are written concurrently, each one reserves the
+// next free range of the file and is written there with a single pwrite, so the
+// bricks are stored in the order they finish. The header and table are written by
+// finish once all the bricks are out.
+class brick_pack_writer {
+	positional_file file;
+	pack_header header;
+	std::vector<pack_entry> entries;
+	std::atomic<uint64_t> data_end;
+
+public:
+	brick_pack_writer(const std::string &fname, const pack_format format, const size_t num_bricks,
+			const bool direct_io);
+
+	// Write the brick with the given id, whose encoded file contents are in the buffer.
+	// Bricks with different ids can be written concurrently. Returns the number of
+	// bytes written to the file.
+	size_t write(const size_t id, const box3f &bounds, const uint64_t num_tris, aligned_buffer &data);
+	void finish();
+};
+
+// A brick pack mapped into memory for reading. Throws a std::runtime_error if the file
+// isn't a valid pack
+class brick_pack {
+	mapped_file file;
+	const pack_header *header;
+	const pack_entry *entries;
+
+public:
+	brick_pack(const std::string &fname);
+
+	pack_format format() const;
+	size_t num_bricks() const;
+	const pack_entry& entry(const size_t id) const;
+	// Get the encoded file contents of the brick
+	const char* brick_data(const size_t id) const;
+};
+
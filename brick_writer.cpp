@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include "brick_writer.h"
+#include "stream_codec.h"
+
+// Typical length of a shortest round trip float, for estimating OBJ sizes
+const size_t OBJ_TYPICAL_FLOAT_LENGTH = 10;
+
+void brick_writer::write_bobj(const mesh_brick &brick, const std::string &fname) {
+	encode_bobj(brick);
+	write_file(fname, buffer, direct_io);
+	bytes_written += buffer.size();
+}
+template<typename T>
+void narrow_indices(const std::vector<uint64_t> &indices, char *out) {
+	T *narrow = reinterpret_cast<T*>(out);
+	for (size_t i = 0; i < indices.size(); ++i) {
+		narrow[i] = static_cast<T>(indices[i]);
+	}
+}
+
+// Quantizes vertex components to a number of bits relative to the bounds
+struct vertex_quantizer {
+	vec3f lower;
+	vec3f scale;
+	float max_q;
+
+	vertex_quantizer(const box3f &bounds, const uint32_t bits)
+		: lower(bounds.lower), max_q(static_cast<float>((1u << bits) - 1))
+	{
+		const vec3f extent = bounds.upper - bounds.lower;
+		scale = vec3f(extent.x > 0.f ? max_q / extent.x : 0.f,
+				extent.y > 0.f ? max_q / extent.y : 0.f,
+				extent.z > 0.f ? max_q / extent.z : 0.f);
+	}
+	uint32_t operator()(const vec3f &v, const int axis) const {
+		return static_cast<uint32_t>(std::min(std::round((v[axis] - lower[axis]) * scale[axis]), max_q));
+	}
+};
+
+void brick_writer::encode_bobj_v2(const mesh_brick &brick) {
+	const bool quantized = quant_bits != 0;
+	// The compressed indices are coded as uint32
+	const bool compressed = compress && brick.verts.size() <= uint64_t(1) << 32;
+	bobj_header header = {};
+	std::memcpy(header.magic, BOBJ_MAGIC, sizeof(BOBJ_MAGIC));
+	header.version = BOBJ_VERSION;
+	header.index_bytes = compressed ? 4 : bobj_index_bytes(brick.verts.size());
+	header.flags = BOBJ_HAS_BOUNDS | (quantized ? BOBJ_QUANTIZED : 0) | (compressed ? BOBJ_COMPRESSED : 0)
+		| (ownership ? BOBJ_HAS_OWNERSHIP : 0);
+	header.quant_bits = quant_bits;
+	header.num_verts = brick.verts.size();
+	header.num_tris = brick.num_tris();
+	header.num_owned_tris = ownership ? brick.num_owned : 0;
+	box3f bounds;
+	for (const auto &v : brick.verts) {
+		bounds.extend(v);
+	}
+	if (brick.verts.empty()) {
+		bounds = box3f(vec3f(0.f), vec3f(0.f));
+	}
+	for (int i = 0; i < 3; ++i) {
+		header.lower[i] = bounds.lower[i];
+		header.upper[i] = bounds.upper[i];
+	}
+	const vertex_quantizer quantize(bounds, quantized ? quant_bits : 1);
+
+	if (compressed) {
+		const size_t nverts = brick.verts.size();
+		// Code each vertex component as a separate plane of its float bits or quantized value
+		stream_values.resize(std::max(nverts, brick.indices.size()));
+		buffer.resize(sizeof(header) + sizeof(bobj_streams) + 3 * delta_vbyte_max_bytes(nverts)
+				+ delta_vbyte_max_bytes(brick.indices.size()));
+		uint8_t *out = reinterpret_cast<uint8_t*>(buffer.data()) + sizeof(header) + sizeof(bobj_streams);
+		bobj_streams streams = {};
+		for (int axis = 0; axis < 3; ++axis) {
+			for (size_t i = 0; i < nverts; ++i) {
+				if (quantized) {
+					stream_values[i] = quantize(brick.verts[i], axis);
+				} else {
+					std::memcpy(&stream_values[i], &brick.verts[i][axis], sizeof(float));
+				}
+			}
+			streams.bytes[axis] = delta_vbyte_encode(stream_values.data(), nverts, out);
+			out += streams.bytes[axis];
+		}
+		for (size_t i = 0; i < brick.indices.size(); ++i) {
+			stream_values[i] = static_cast<uint32_t>(brick.indices[i]);
+		}
+		streams.bytes[3] = delta_vbyte_encode(stream_values.data(), brick.indices.size(), out);
+		out += streams.bytes[3];
+
+		std::memcpy(buffer.data(), &header, sizeof(header));
+		std::memcpy(buffer.data() + sizeof(header), &streams, sizeof(streams));
+		buffer.resize(reinterpret_cast<char*>(out) - buffer.data());
+		return;
+	}
+
+	const size_t verts_bytes = bobj_verts_bytes(brick.verts.size(), quantized);
+	const size_t indices_bytes = header.index_bytes * brick.indices.size();
+	buffer.resize(sizeof(header) + verts_bytes + indices_bytes);
+	char *out = buffer.data();
+	std::memcpy(out, &header, sizeof(header));
+	out += sizeof(header);
+	if (!quantized) {
+		std::memcpy(out, brick.verts.data(), sizeof(vec3f) * brick.verts.size());
+	} else {
+		uint16_t *q = reinterpret_cast<uint16_t*>(out);
+		for (const auto &v : brick.verts) {
+			for (int i = 0; i < 3; ++i) {
+				*q++ = static_cast<uint16_t>(quantize(v, i));
+			}
+		}
+	}
+	// Zero the padding after the vertices
+	const size_t verts_used = brick.verts.size() * 3 * (quantized ? sizeof(uint16_t) : sizeof(float));
+	std::memset(out + verts_used, 0, verts_bytes - verts_used);
+	out += verts_bytes;
+
+	switch (header.index_bytes) {
+		case 2: narrow_indices<uint16_t>(brick.indices, out); break;
+		case 4: narrow_indices<uint32_t>(brick.indices, out); break;
+		default: std::memcpy(out, brick.indices.data(), indices_bytes); break;
+	}
+}
+
+void brick_writer::encode_bobj(const mesh_brick &brick) {
+	if (bobj_v2) {
+		encode_bobj_v2(brick);
+		return;
+	}
+	const uint64_t header[2] = {brick.verts.size(), brick.num_tris()};
+	const size_t verts_bytes = sizeof(vec3f) * brick.verts.size();
+	const size_t indices_bytes = sizeof(uint64_t) * brick.indices.size();
+	buffer.resize(sizeof(header) + verts_bytes + indices_bytes);
+
+	char *out = buffer.data();
+	std::memcpy(out, header, sizeof(header));
+	out += sizeof(header);
+	std::memcpy(out, brick.verts.data(), verts_bytes);
+	out += verts_bytes;
+	std::memcpy(out, brick.indices.data(), indices_bytes);
+}
+uint64_t brick_writer::estimated_size(const uint64_t num_verts, const uint64_t num_tris,
+		const bool binary) const
+{
+	if (!binary) {
+		uint64_t index_digits = 1;
+		for (uint64_t n = num_verts; n >= 10; n /= 10) {
+			++index_digits;
+		}
+		const uint64_t vert_line = 2 + 3 * (1 + OBJ_TYPICAL_FLOAT_LENGTH);
+		const uint64_t tri_line = 2 + 3 * (1 + index_digits);
+		return num_verts * vert_line + num_tris * tri_line + (ownership ? 16 : 0);
+	}
+	if (!bobj_v2) {
+		return 2 * sizeof(uint64_t) + num_verts * sizeof(vec3f) + 3 * num_tris * sizeof(uint64_t);
+	}
+	const uint64_t index_bytes = compress && num_verts <= uint64_t(1) << 32 ? 4 : bobj_index_bytes(num_verts);
+	return sizeof(bobj_header) + bobj_verts_bytes(num_verts, quant_bits != 0) + 3 * num_tris * index_bytes;
+}
+
+char* format_vertex(char *out, const vec3f &v) {
+	*out++ = 'v';
+	for (const float x : {v.x, v.y, v.z}) {
+		*out++ = ' ';
+		out = std::to_chars(out, out + OBJ_MAX_NUMBER_LENGTH, x).ptr;
+	}
+	*out++ = '\n';
+	return out;
+}
+// Write the group line starting the owned or ghost triangles if triangle t is the
+// first of them
+char* format_ownership_group(char *out, const mesh_brick &brick, const size_t t) {
+	const char *group = nullptr;
+	if (t == 0 && brick.num_owned != 0) {
+		group = "g owned\n";
+	} else if (t == brick.num_owned) {
+		group = "g ghost\n";
+	}
+	if (group) {
+		const size_t len = std::strlen(group);
+		std::memcpy(out, group, len);
+		out += len;
+	}
+	return out;
+}
+char* format_triangle(char *out, const uint64_t *tids) {
+	*out++ = 'f';
+	for (size_t i = 0; i < 3; ++i) {
+		*out++ = ' ';
+		out = std::to_chars(out, out + OBJ_MAX_NUMBER_LENGTH, tids[i] + 1).ptr;
+	}
+	*out++ = '\n';
+	return out;
+}
+
+void brick_writer::write_obj(const mesh_brick &brick, const std::string &fname) {
+	output_file fout(fname);
+	// Leave room past the flush point for a line and an ownership group line
+	buffer.resize(OBJ_TEXT_CHUNK_SIZE + 2 * OBJ_MAX_LINE_LENGTH);
+	char *begin = buffer.data();
+	char *flush_at = begin + OBJ_TEXT_CHUNK_SIZE;
+	char *out = begin;
+	for (const auto &vert : brick.verts) {
+		out = format_vertex(out, vert);
+		if (out >= flush_at) {
+			fout.write(begin, out - begin);
+			bytes_written += out - begin;
+			out = begin;
+		}
+	}
+	for (size_t t = 0; t < brick.num_tris(); ++t) {
+		if (ownership) {
+			out = format_ownership_group(out, brick, t);
+		}
+		out = format_triangle(out, &brick.indices[3 * t]);
+		if (out >= flush_at) {
+			fout.write(begin, out - begin);
+			bytes_written += out - begin;
+			out = begin;
+		}
+	}
+	fout.write(begin, out - begin);
+	bytes_written += out - begin;
+}
+void brick_writer::encode_obj(const mesh_brick &brick) {
+	// Size the buffer for the longest possible lines, only the pages
+	// actually written to are touched. The two ownership group lines fit in the
+	// space of one line
+	buffer.resize((brick.verts.size() + brick.num_tris() + 1) * OBJ_MAX_LINE_LENGTH);
+	char *out = buffer.data();
+	for (const auto &vert : brick.verts) {
+		out = format_vertex(out, vert);
+	}
+	for (size_t t = 0; t < brick.num_tris(); ++t) {
+		if (ownership) {
+			out = format_ownership_group(out, brick, t);
+		}
+		out = format_triangle(out, &brick.indices[3 * t]);
+	}
+	buffer.resize(out - buffer.data());
+}
+
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include "brick.h"
+#include "file_io.h"
+#include "bobj.h"
+
+// Size of text accumulated in the buffer before writing it out to an OBJ file
+const size_t OBJ_TEXT_CHUNK_SIZE = 8 << 20;
+// Upper bounds on the length of a formatted float or index and of a full v or f line
+const size_t OBJ_MAX_NUMBER_LENGTH = 32;
+const size_t OBJ_MAX_LINE_LENGTH = 4 + 3 * OBJ_MAX_NUMBER_LENGTH;
+
+// Format an OBJ vertex line, with each float in its shortest form which reads back
+// to exactly the same value, at out and return the end of the line
+char* format_vertex(char *out, const vec3f &v);
+// Format an OBJ face line of the 0 based vertex indices at out and return the end of the line
+char* format_triangle(char *out, const uint64_t *tids);
+
+// Writes bricks out to files. A writer keeps its output buffer between bricks,
+// so each thread should reuse its own writer
+struct brick_writer {
+	aligned_buffer buffer;
+	// Write files with O_DIRECT, bypassing the page cache
+	bool direct_io = false;
+	// Write version 2 .bobj files, which store each brick's indices with the
+	// narrowest type that fits and the bounds of its vertices
+	bool bobj_v2 = false;
+	// If nonzero, version 2 .bobj vertices are quantized to this many bits per
+	// component relative to the brick's bounds, at most BOBJ_MAX_QUANT_BITS
+	uint32_t quant_bits = 0;
+	// Compress the vertices and indices of version 2 .bobj files
+	bool compress = false;
+	// Record which of the brick's triangles it owns. Version 2 .bobj files store the
+	// number of owned triangles in the header, and OBJ files put the owned and ghost
+	// triangles in separate "owned" and "ghost" groups. Original .bobj files have
+	// nowhere to store it
+	bool ownership = false;
+	// Total bytes of brick data written by this writer
+	uint64_t bytes_written = 0;
+
+	// Write the brick as a binary .bobj file. The header, vertices and indices are
+	// assembled in one buffer which is written out in a single large write
+	void write_bobj(const mesh_brick &brick, const std::string &fname);
+	// Write the brick as a text OBJ file. Floats are written in their shortest form
+	// which reads back to exactly the same value
+	void write_obj(const mesh_brick &brick, const std::string &fname);
+
+	// Encode the entire brick into the buffer as a .bobj or text OBJ file, for
+	// writing the brick somewhere other than its own file
+	void encode_bobj(const mesh_brick &brick);
+	void encode_obj(const mesh_brick &brick);
+
+	// Estimate the size of a brick with this many vertices and triangles written as a
+	// .bobj or OBJ file with the writer's settings. Compressed bricks are estimated at
+	// their uncompressed size and OBJ bricks from a typical vertex line length
+	uint64_t estimated_size(const uint64_t num_verts, const uint64_t num_tris, const bool binary) const;
+
+private:
+	std::vector<uint32_t> stream_values;
+
+	void encode_bobj_v2(const mesh_brick &brick);
+};
+
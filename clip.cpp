@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <array>
+#include <limits>
+#include "clip.h"
+
+// A triangle clipped by the 6 planes of a box has at most 9 vertices
+const size_t MAX_CLIP_VERTS = 9;
+const uint64_t NOT_REMAPPED = std::numeric_limits<uint64_t>::max();
+
+// A vertex of a triangle being clipped. Corners has a bit set for each corner of
+// the source triangle on the edge the vertex lies on: one bit for the corners
+// themselves, two for points on an edge and none for points inside the triangle
+struct clip_vertex {
+	vec3f pos;
+	uint8_t corners;
+};
+
+// Leave room for extra crossings when rounding makes the polygon slightly non-convex
+const size_t CLIP_POLYGON_CAPACITY = 2 * MAX_CLIP_VERTS;
+
+struct clip_polygon {
+	std::array<clip_vertex, CLIP_POLYGON_CAPACITY> verts;
+	size_t count = 0;
+
+	void push_back(const clip_vertex &v) {
+		// Skip repeated points, keeping the source corner if a new point lands on it
+		if (count > 0 && verts[count - 1].pos == v.pos) {
+			if (__builtin_popcount(v.corners) == 1) {
+				verts[count - 1] = v;
+			}
+			return;
+		}
+		if (count < verts.size()) {
+			verts[count++] = v;
+		}
+	}
+};
+
+inline bool inside_plane(const vec3f &p, const int axis, const float value, const bool keep_above) {
+	return keep_above ? p[axis] >= value : p[axis] <= value;
+}
+
+// Find where the edge from a to b crosses the plane. If both lie on the same edge
+// of the source triangle the point is computed from that edge's corners instead,
+// and the endpoints are always ordered the same way, so every triangle sharing the
+// edge computes exactly the same point. The planes are clipped against in axis
+// order, and the point is clamped to the bounds along the axes already clipped
+// since rounding can put it slightly outside them
+clip_vertex intersect_plane(const clip_vertex &a, const clip_vertex &b, const std::array<vec3f, 3> &tri,
+		const box3f &bounds, const int axis, const float value)
+{
+	uint8_t corners = a.corners | b.corners;
+	vec3f p = a.pos;
+	vec3f q = b.pos;
+	if (a.corners != 0 && b.corners != 0 && __builtin_popcount(corners) == 2) {
+		p = tri[__builtin_ctz(corners)];
+		q = tri[31 - __builtin_clz(corners)];
+	} else {
+		corners = 0;
+	}
+	if (q < p) {
+		std::swap(p, q);
+	}
+	const float t = (value - p[axis]) / (q[axis] - p[axis]);
+	vec3f x = p + (q - p) * t;
+	for (int i = 0; i < axis; ++i) {
+		x[i] = std::min(std::max(x[i], bounds.lower[i]), bounds.upper[i]);
+	}
+	x[axis] = value;
+	return clip_vertex{x, corners};
+}
+
+void clip_to_plane(const clip_polygon &in, clip_polygon &out, const std::array<vec3f, 3> &tri,
+		const box3f &bounds, const int axis, const bool keep_above)
+{
+	const float value = keep_above ? bounds.lower[axis] : bounds.upper[axis];
+	out.count = 0;
+	for (size_t i = 0; i < in.count; ++i) {
+		const clip_vertex &cur = in.verts[i];
+		const clip_vertex &next = in.verts[(i + 1) % in.count];
+		const bool cur_inside = inside_plane(cur.pos, axis, value, keep_above);
+		const bool next_inside = inside_plane(next.pos, axis, value, keep_above);
+		if (cur_inside) {
+			out.push_back(cur);
+		}
+		if (cur_inside != next_inside) {
+			out.push_back(intersect_plane(cur, next, tri, bounds, axis, value));
+		}
+	}
+	// The last point may repeat the first
+	if (out.count > 1 && out.verts[out.count - 1].pos == out.verts[0].pos) {
+		if (__builtin_popcount(out.verts[out.count - 1].corners) == 1) {
+			out.verts[0] = out.verts[out.count - 1];
+		}
+		--out.count;
+	}
+}
+
+inline bool inside_box(const vec3f &p, const box3f &b) {
+	return p.x >= b.lower.x && p.y >= b.lower.y && p.z >= b.lower.z
+		&& p.x <= b.upper.x && p.y <= b.upper.y && p.z <= b.upper.z;
+}
+
+const mesh_brick& brick_clipper::clip(const mesh_brick &in, const box3f &bounds) {
+	brick.clear();
+	const size_t ntris = in.num_tris();
+	size_t nclipped = 0;
+	for (size_t t = 0; t < ntris; ++t) {
+		for (size_t i = 0; i < 3; ++i) {
+			if (!inside_box(in.verts[in.indices[3 * t + i]], bounds)) {
+				++nclipped;
+				break;
+			}
+		}
+	}
+	weld.reset(CLIP_POLYGON_CAPACITY * nclipped, 0.f);
+	vertex_remap.assign(in.verts.size(), NOT_REMAPPED);
+	brick.indices.reserve(in.indices.size() + 3 * (MAX_CLIP_VERTS - 3) * nclipped);
+
+	auto source_vertex = [&](const uint64_t v) {
+		if (vertex_remap[v] == NOT_REMAPPED) {
+			vertex_remap[v] = brick.verts.size();
+			brick.verts.push_back(in.verts[v]);
+		}
+		return vertex_remap[v];
+	};
+
+	clip_polygon poly, clipped;
+	std::array<uint64_t, CLIP_POLYGON_CAPACITY> ids;
+	for (size_t t = 0; t < ntris; ++t) {
+		const uint64_t *tri_ids = &in.indices[3 * t];
+		const std::array<vec3f, 3> tri{in.verts[tri_ids[0]], in.verts[tri_ids[1]], in.verts[tri_ids[2]]};
+		if (inside_box(tri[0], bounds) && inside_box(tri[1], bounds) && inside_box(tri[2], bounds)) {
+			for (size_t i = 0; i < 3; ++i) {
+				brick.indices.push_back(source_vertex(tri_ids[i]));
+			}
+			continue;
+		}
+
+		poly.count = 0;
+		for (size_t i = 0; i < 3; ++i) {
+			poly.push_back(clip_vertex{tri[i], static_cast<uint8_t>(1 << i)});
+		}
+		for (int axis = 0; axis < 3 && poly.count >= 3; ++axis) {
+			clip_to_plane(poly, clipped, tri, bounds, axis, true);
+			clip_to_plane(clipped, poly, tri, bounds, axis, false);
+		}
+		if (poly.count < 3) {
+			continue;
+		}
+
+		for (size_t i = 0; i < poly.count; ++i) {
+			const clip_vertex &v = poly.verts[i];
+			if (__builtin_popcount(v.corners) == 1) {
+				ids[i] = source_vertex(tri_ids[__builtin_ctz(v.corners)]);
+			} else {
+				ids[i] = weld.find_or_insert(v.pos, brick.verts.size());
+				if (ids[i] == brick.verts.size()) {
+					brick.verts.push_back(v.pos);
+				}
+			}
+		}
+		for (size_t i = 1; i + 1 < poly.count; ++i) {
+			if (ids[0] != ids[i] && ids[0] != ids[i + 1] && ids[i] != ids[i + 1]) {
+				brick.indices.push_back(ids[0]);
+				brick.indices.push_back(ids[i]);
+				brick.indices.push_back(ids[i + 1]);
+			}
+		}
+	}
+	brick.num_owned = brick.num_tris();
+	return brick;
+}
+
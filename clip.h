@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "math.h"
+#include "brick.h"
+
+// Clips the triangles of bricks to the bricks' bounds. The clipper keeps its tables
+// and output brick between bricks, so each thread should reuse its own clipper
+struct brick_clipper {
+	position_weld_table weld;
+	std::vector<uint64_t> vertex_remap;
+	mesh_brick brick;
+
+	// Clip the triangles of the brick against the bounds with Sutherland-Hodgman and
+	// fan triangulate the clipped polygons. Triangles entirely inside the bounds are
+	// kept as is and vertices no longer used are dropped. The new vertices on the
+	// bounds are welded, and each is computed from the endpoints of the source edge
+	// it lies on taken in a fixed order, so the triangles on either side of an edge,
+	// and the bricks on either side of a boundary, create exactly the same vertex.
+	// All the clipped triangles are owned by the brick. Returns the clipped copy of
+	// the brick.
+	const mesh_brick& clip(const mesh_brick &in, const box3f &bounds);
+};
+
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "distributed.h"
+
+// How long workers keep trying to reach the coordinator before giving up
+const int CONNECT_RETRY_SECONDS = 30;
+// Workers send their binned triangles in messages of at most this many
+// (cell, triangle id) pairs, so the coordinator only buffers one at a time
+const size_t PAIRS_PER_MESSAGE = size_t(1) << 18;
+
+enum MESSAGE_TYPE : uint32_t {
+	MSG_HELLO,
+	MSG_BOUNDS,
+	MSG_TRIANGLES,
+	MSG_DONE,
+};
+
+// Messages are a header followed by size bytes of payload. For MSG_HELLO the
+// rank is the sender's rank, for MSG_TRIANGLES sent by a worker it's the
+// destination rank
+struct message_header {
+	uint32_t type;
+	uint32_t rank;
+	uint64_t size;
+};
+
+void send_all(const int fd, const void *data, size_t n) {
+	const char *p = static_cast<const char*>(data);
+	while (n > 0) {
+		const ssize_t sent = send(fd, p, n, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error(std::string("Failed to send message: ") + std::strerror(errno));
+		}
+		p += sent;
+		n -= sent;
+	}
+}
+void recv_all(const int fd, void *data, size_t n) {
+	char *p = static_cast<char*>(data);
+	while (n > 0) {
+		const ssize_t got = recv(fd, p, n, 0);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		if (got <= 0) {
+			throw std::runtime_error(got == 0 ? std::string("Connection closed")
+					: std::string("Failed to receive message: ") + std::strerror(errno));
+		}
+		p += got;
+		n -= got;
+	}
+}
+void send_message(const int fd, const MESSAGE_TYPE type, const uint32_t rank,
+		const void *data, const size_t size)
+{
+	const message_header header{type, rank, size};
+	send_all(fd, &header, sizeof(header));
+	send_all(fd, data, size);
+}
+message_header recv_message(const int fd, std::vector<char> &payload) {
+	message_header header;
+	recv_all(fd, &header, sizeof(header));
+	payload.resize(header.size);
+	recv_all(fd, payload.data(), header.size);
+	return header;
+}
+message_header expect_message(const int fd, const MESSAGE_TYPE type, std::vector<char> &payload) {
+	const message_header header = recv_message(fd, payload);
+	if (header.type != type) {
+		throw std::runtime_error("Unexpected message type " + std::to_string(header.type)
+				+ ", expected " + std::to_string(type));
+	}
+	return header;
+}
+
+// Receive a message holding a box3f of bounds
+box3f expect_bounds(const int fd, std::vector<char> &payload) {
+	expect_message(fd, MSG_BOUNDS, payload);
+	if (payload.size() != sizeof(box3f)) {
+		throw std::runtime_error("Malformed bounds message of " + std::to_string(payload.size()) + " bytes");
+	}
+	box3f bounds;
+	std::memcpy(&bounds, payload.data(), sizeof(box3f));
+	return bounds;
+}
+
+// Receive the next message of (cell, triangle id) pairs forwarded by the coordinator.
+// Returns false once the coordinator says all the triangles have been sent
+bool expect_triangles(const int fd, std::vector<char> &payload) {
+	const message_header header = recv_message(fd, payload);
+	if (header.type == MSG_DONE) {
+		return false;
+	}
+	if (header.type != MSG_TRIANGLES) {
+		throw std::runtime_error("Unexpected message type " + std::to_string(header.type)
+				+ ", expected " + std::to_string(MSG_TRIANGLES));
+	}
+	if (payload.size() % (2 * sizeof(uint64_t)) != 0) {
+		throw std::runtime_error("Malformed triangle message of " + std::to_string(payload.size()) + " bytes");
+	}
+	return true;
+}
+
+void run_coordinator(const int port, const size_t nranks) {
+	const int listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+	if (listen_fd == -1) {
+		throw std::runtime_error(std::string("Failed to create socket: ") + std::strerror(errno));
+	}
+	const int on = 1;
+	const int off = 0;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+	sockaddr_in6 addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	addr.sin6_port = htons(port);
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1
+			|| listen(listen_fd, nranks) == -1)
+	{
+		close(listen_fd);
+		throw std::runtime_error("Failed to listen on port " + std::to_string(port)
+				+ ": " + std::strerror(errno));
+	}
+
+	std::vector<int> workers(nranks, -1);
+	std::vector<char> payload;
+	for (size_t i = 0; i < nranks; ++i) {
+		const int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd == -1) {
+			throw std::runtime_error(std::string("Failed to accept worker: ") + std::strerror(errno));
+		}
+		const message_header hello = expect_message(fd, MSG_HELLO, payload);
+		if (hello.rank >= nranks || workers[hello.rank] != -1) {
+			throw std::runtime_error("Invalid or duplicate worker rank " + std::to_string(hello.rank));
+		}
+		workers[hello.rank] = fd;
+	}
+	close(listen_fd);
+
+	box3f bounds;
+	for (const auto &fd : workers) {
+		bounds.extend(expect_bounds(fd, payload));
+	}
+	for (const auto &fd : workers) {
+		send_message(fd, MSG_BOUNDS, 0, &bounds, sizeof(bounds));
+	}
+
+	// Forward each message of binned triangles to the rank owning the cells as it
+	// arrives, reading from whichever worker is ready. The workers receive while
+	// they're sending, so a forward blocked on a worker that's still sending can't
+	// wait on us
+	std::vector<pollfd> fds(nranks);
+	for (size_t i = 0; i < nranks; ++i) {
+		fds[i].fd = workers[i];
+		fds[i].events = POLLIN;
+	}
+	size_t ndone = 0;
+	while (ndone < nranks) {
+		if (poll(fds.data(), fds.size(), -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error(std::string("Failed to poll workers: ") + std::strerror(errno));
+		}
+		for (auto &p : fds) {
+			if (!(p.revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+			const message_header header = recv_message(p.fd, payload);
+			if (header.type == MSG_TRIANGLES && header.rank < nranks) {
+				send_message(workers[header.rank], MSG_TRIANGLES, header.rank, payload.data(), payload.size());
+			} else if (header.type == MSG_DONE) {
+				// Stop polling this worker, it won't send anything else
+				p.fd = -p.fd - 1;
+				++ndone;
+			} else {
+				throw std::runtime_error("Unexpected message type " + std::to_string(header.type));
+			}
+		}
+	}
+	for (size_t i = 0; i < nranks; ++i) {
+		send_message(workers[i], MSG_DONE, i, nullptr, 0);
+		close(workers[i]);
+	}
+}
+
+worker_connection::worker_connection(const std::string &coordinator, const size_t rank,
+		const size_t nranks)
+	: fd(-1), rank(rank), nranks(nranks)
+{
+	const size_t sep = coordinator.rfind(':');
+	if (sep == std::string::npos) {
+		throw std::runtime_error("Coordinator address must be host:port, got " + coordinator);
+	}
+	const std::string host = coordinator.substr(0, sep);
+	const std::string port = coordinator.substr(sep + 1);
+
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(CONNECT_RETRY_SECONDS);
+	while (fd == -1) {
+		addrinfo *addrs = nullptr;
+		const int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs);
+		if (err != 0) {
+			throw std::runtime_error("Failed to resolve " + coordinator + ": " + gai_strerror(err));
+		}
+		for (addrinfo *a = addrs; a && fd == -1; a = a->ai_next) {
+			fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (fd != -1 && connect(fd, a->ai_addr, a->ai_addrlen) == -1) {
+				close(fd);
+				fd = -1;
+			}
+		}
+		freeaddrinfo(addrs);
+		if (fd == -1) {
+			if (std::chrono::steady_clock::now() > give_up) {
+				throw std::runtime_error("Failed to connect to coordinator at " + coordinator);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+	const int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	send_message(fd, MSG_HELLO, rank, nullptr, 0);
+}
+worker_connection::~worker_connection() {
+	close(fd);
+}
+void worker_connection::slice(const size_t n, size_t &begin, size_t &end) const {
+	begin = (n / nranks) * rank + std::min(rank, n % nranks);
+	end = begin + n / nranks + (rank < n % nranks ? 1 : 0);
+}
+bool worker_connection::owns_cell(const size_t cell) const {
+	return cell % nranks == rank;
+}
+box3f worker_connection::reduce_bounds(const box3f &local_bounds) {
+	send_message(fd, MSG_BOUNDS, rank, &local_bounds, sizeof(local_bounds));
+	std::vector<char> payload;
+	return expect_bounds(fd, payload);
+}
+std::vector<std::vector<size_t>> worker_connection::exchange_triangles(
+		const std::vector<std::vector<size_t>> &cell_tris)
+{
+	// Receive the triangles for our cells while sending, since the coordinator
+	// forwards them as soon as the other workers send them
+	std::vector<std::vector<size_t>> owned(cell_tris.size());
+	std::exception_ptr recv_error;
+	std::thread receiver([&]() {
+		try {
+			std::vector<char> payload;
+			std::vector<uint64_t> pairs;
+			while (expect_triangles(fd, payload)) {
+				pairs.resize(payload.size() / sizeof(uint64_t));
+				std::memcpy(pairs.data(), payload.data(), payload.size());
+				for (size_t i = 0; i < pairs.size(); i += 2) {
+					if (pairs[i] >= owned.size() || !owns_cell(pairs[i])) {
+						throw std::runtime_error("Received triangle for a cell not owned by this rank");
+					}
+					owned[pairs[i]].push_back(pairs[i + 1]);
+				}
+			}
+		} catch (...) {
+			recv_error = std::current_exception();
+		}
+	});
+
+	// Triangles are sent as (cell, triangle id) pairs
+	try {
+		std::vector<uint64_t> pairs;
+		for (size_t r = 0; r < nranks; ++r) {
+			pairs.clear();
+			for (size_t i = r; i < cell_tris.size(); i += nranks) {
+				for (const auto &t : cell_tris[i]) {
+					pairs.push_back(i);
+					pairs.push_back(t);
+					if (pairs.size() == 2 * PAIRS_PER_MESSAGE) {
+						send_message(fd, MSG_TRIANGLES, r, pairs.data(), sizeof(uint64_t) * pairs.size());
+						pairs.clear();
+					}
+				}
+			}
+			if (!pairs.empty()) {
+				send_message(fd, MSG_TRIANGLES, r, pairs.data(), sizeof(uint64_t) * pairs.size());
+			}
+		}
+		send_message(fd, MSG_DONE, rank, nullptr, 0);
+	} catch (...) {
+		// Unblock the receiver before giving up
+		shutdown(fd, SHUT_RDWR);
+		receiver.join();
+		throw;
+	}
+	receiver.join();
+	if (recv_error) {
+		std::rethrow_exception(recv_error);
+	}
+
+	for (auto &tris : owned) {
+		std::sort(tris.begin(), tris.end());
+	}
+	return owned;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+
+// Run the coordinator for a distributed gridding job with nranks workers, listening
+// for the workers on the port. The coordinator reduces the model bounds across the
+// workers and forwards the binned triangles to the rank owning each cell as they
+// arrive, so it only holds one message of them at a time. Returns once all workers
+// have been sent their triangles.
+void run_coordinator(const int port, const size_t nranks);
+
+// A worker's connection to the coordinator of a distributed gridding job. Each worker
+// bins a slice of the triangles, and the bricks are divided between the workers so
+// each brick is written by exactly one rank.
+class worker_connection {
+	int fd;
+
+public:
+	const size_t rank;
+	const size_t nranks;
+
+	// Connect to the coordinator at host:port, retrying for a while if
+	// the coordinator isn't up yet
+	worker_connection(const std::string &coordinator, const size_t rank, const size_t nranks);
+	~worker_connection();
+	worker_connection(const worker_connection &) = delete;
+	worker_connection& operator=(const worker_connection &) = delete;
+
+	// Get the range of items [begin, end) this rank is responsible for out of n items
+	void slice(const size_t n, size_t &begin, size_t &end) const;
+	// Check if the cell's brick is written by this rank
+	bool owns_cell(const size_t cell) const;
+	// Combine the bounds from each worker, all workers get the combined bounds
+	box3f reduce_bounds(const box3f &local_bounds);
+	// Send the triangles this worker binned to the ranks owning each cell, while
+	// receiving the triangles for the cells owned by this rank on another thread.
+	// Returns the triangles from all workers for this rank's cells, sorted by
+	// triangle id
+	std::vector<std::vector<size_t>> exchange_triangles(
+			const std::vector<std::vector<size_t>> &cell_tris);
+};
+
@@ -0,0 +1,232 @@
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "file_io.h"
+
+mapped_file::mapped_file(const std::string &fname) : fd(-1), ptr(nullptr), len(0) {
+	fd = open(fname.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open " + fname + ": " + std::strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		throw std::runtime_error("Failed to stat " + fname + ": " + std::strerror(errno));
+	}
+	len = st.st_size;
+	if (len > 0) {
+		ptr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+		if (ptr == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map " + fname + ": " + std::strerror(errno));
+		}
+	}
+}
+mapped_file::~mapped_file() {
+	if (ptr) {
+		munmap(ptr, len);
+	}
+	close(fd);
+}
+const char* mapped_file::data() const {
+	return static_cast<const char*>(ptr);
+}
+size_t mapped_file::size() const {
+	return len;
+}
+void mapped_file::advise(size_t offset, size_t nbytes, int advice) const {
+	if (!ptr || offset >= len) {
+		return;
+	}
+	// madvise needs a page aligned start address
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	const size_t aligned_offset = offset - offset % page_size;
+	nbytes = std::min(nbytes + offset - aligned_offset, len - aligned_offset);
+	madvise(static_cast<char*>(ptr) + aligned_offset, nbytes, advice);
+}
+
+input_file::input_file(const std::string &fname) : fd(-1), len(0), fname(fname) {
+	fd = open(fname.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open " + fname + ": " + std::strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		throw std::runtime_error("Failed to stat " + fname + ": " + std::strerror(errno));
+	}
+	len = st.st_size;
+}
+input_file::~input_file() {
+	close(fd);
+}
+void input_file::read(char *data, size_t n, uint64_t offset) const {
+	// Linux transfers at most about 2GB per call
+	const size_t max_read = size_t(1) << 30;
+	while (n > 0) {
+		const ssize_t nread = pread(fd, data, std::min(n, max_read), offset);
+		if (nread < 0 && errno == EINTR) {
+			continue;
+		}
+		if (nread < 0) {
+			throw std::runtime_error("Failed to read " + fname + ": " + std::strerror(errno));
+		}
+		if (nread == 0) {
+			throw std::runtime_error("Unexpected end of file reading " + fname);
+		}
+		data += nread;
+		offset += nread;
+		n -= nread;
+	}
+}
+size_t input_file::size() const {
+	return len;
+}
+
+aligned_buffer::aligned_buffer() : ptr(nullptr), len(0), capacity(0) {}
+aligned_buffer::~aligned_buffer() {
+	std::free(ptr);
+}
+void aligned_buffer::resize(const size_t n) {
+	if (n > capacity) {
+		std::free(ptr);
+		capacity = ((n + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT;
+		if (posix_memalign(reinterpret_cast<void**>(&ptr), DIRECT_IO_ALIGNMENT, capacity) != 0) {
+			ptr = nullptr;
+			capacity = 0;
+			throw std::bad_alloc();
+		}
+	}
+	len = n;
+}
+char* aligned_buffer::data() {
+	return ptr;
+}
+const char* aligned_buffer::data() const {
+	return ptr;
+}
+size_t aligned_buffer::size() const {
+	return len;
+}
+size_t aligned_buffer::reserved() const {
+	return capacity;
+}
+
+// Write all n bytes of data to the file at offset, returns false and sets errno on error
+bool pwrite_all(const int fd, const char *data, size_t n, off_t offset) {
+	// Linux transfers at most about 2GB per call
+	const size_t max_write = size_t(1) << 30;
+	while (n > 0) {
+		const ssize_t written = pwrite(fd, data, std::min(n, max_write), offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		// No progress would otherwise retry forever
+		if (written == 0) {
+			errno = EIO;
+			return false;
+		}
+		data += written;
+		offset += written;
+		n -= written;
+	}
+	return true;
+}
+
+output_file::output_file(const std::string &fname, const bool append)
+	: fd(-1), offset(0), fname(fname)
+{
+	fd = open(fname.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open " + fname + ": " + std::strerror(errno));
+	}
+	if (append) {
+		const off_t end = lseek(fd, 0, SEEK_END);
+		if (end == -1) {
+			close(fd);
+			throw std::runtime_error("Failed to seek " + fname + ": " + std::strerror(errno));
+		}
+		offset = end;
+	}
+}
+output_file::~output_file() {
+	close(fd);
+}
+void output_file::write(const char *data, const size_t n) {
+	if (!pwrite_all(fd, data, n, offset)) {
+		throw std::runtime_error("Failed to write " + fname + ": " + std::strerror(errno));
+	}
+	offset += n;
+}
+
+positional_file::positional_file(const std::string &fname, const bool direct)
+	: fd(-1), direct_fd(-1), fname(fname)
+{
+	fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open " + fname + ": " + std::strerror(errno));
+	}
+	// Fall back to buffered writes if direct I/O isn't supported
+	if (direct) {
+		direct_fd = open(fname.c_str(), O_WRONLY | O_DIRECT);
+	}
+}
+positional_file::~positional_file() {
+	if (direct_fd != -1) {
+		close(direct_fd);
+	}
+	close(fd);
+}
+void positional_file::write(const char *data, const size_t n, const uint64_t offset) {
+	if (!pwrite_all(fd, data, n, offset)) {
+		throw std::runtime_error("Failed to write " + fname + ": " + std::strerror(errno));
+	}
+}
+size_t positional_file::write_padded(aligned_buffer &buf, const uint64_t offset) {
+	const size_t padded_size = ((buf.size() + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT)
+		* DIRECT_IO_ALIGNMENT;
+	std::memset(buf.data() + buf.size(), 0, padded_size - buf.size());
+	if (!pwrite_all(direct_fd != -1 ? direct_fd : fd, buf.data(), padded_size, offset)) {
+		throw std::runtime_error("Failed to write " + fname + ": " + std::strerror(errno));
+	}
+	return padded_size;
+}
+void positional_file::truncate(const uint64_t size) {
+	if (ftruncate(fd, size) != 0) {
+		throw std::runtime_error("Failed to truncate " + fname + ": " + std::strerror(errno));
+	}
+}
+bool positional_file::direct() const {
+	return direct_fd != -1;
+}
+
+void write_file(const std::string &fname, aligned_buffer &buf, const bool direct) {
+	if (direct) {
+		const int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		if (fd != -1) {
+			const size_t padded_size = ((buf.size() + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT)
+				* DIRECT_IO_ALIGNMENT;
+			std::memset(buf.data() + buf.size(), 0, padded_size - buf.size());
+			const bool ok = pwrite_all(fd, buf.data(), padded_size, 0)
+				&& ftruncate(fd, buf.size()) == 0;
+			close(fd);
+			if (ok) {
+				return;
+			}
+		}
+		// Fall through to a buffered write if direct I/O isn't supported
+	}
+	output_file fout(fname);
+	fout.write(buf.data(), buf.size());
+}
+
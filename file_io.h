@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+// A read-only memory mapping of an entire file. The mapping is shared, so
+// concurrent processes mapping the same file share its pages in the page cache
+class mapped_file {
+	int fd;
+	void *ptr;
+	size_t len;
+
+public:
+	mapped_file(const std::string &fname);
+	~mapped_file();
+	mapped_file(const mapped_file &) = delete;
+	mapped_file& operator=(const mapped_file &) = delete;
+
+	const char* data() const;
+	size_t size() const;
+	// Hint to the kernel how the byte range [offset, offset + nbytes) of the file
+	// will be accessed, advice is one of the madvise MADV_* values
+	void advise(size_t offset, size_t nbytes, int advice) const;
+};
+
+// A file opened for reading at explicit offsets, for reading a file in pieces
+// without mapping it. Reads can be made concurrently from multiple threads
+class input_file {
+	int fd;
+	size_t len;
+	std::string fname;
+
+public:
+	input_file(const std::string &fname);
+	~input_file();
+	input_file(const input_file &) = delete;
+	input_file& operator=(const input_file &) = delete;
+
+	// Read n bytes at offset in the file into data, throws if the file ends first
+	void read(char *data, const size_t n, const uint64_t offset) const;
+	size_t size() const;
+};
+
+// Alignment of buffers, file offsets and write sizes needed for direct I/O
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+// A growable byte buffer aligned to DIRECT_IO_ALIGNMENT. The buffer's capacity
+// is always a multiple of the alignment, so it can be padded out for direct I/O
+class aligned_buffer {
+	char *ptr;
+	size_t len;
+	size_t capacity;
+
+public:
+	aligned_buffer();
+	~aligned_buffer();
+	aligned_buffer(const aligned_buffer &) = delete;
+	aligned_buffer& operator=(const aligned_buffer &) = delete;
+
+	// Resize the buffer to n bytes, the contents are not preserved if the buffer grows
+	void resize(const size_t n);
+	char* data();
+	const char* data() const;
+	size_t size() const;
+	size_t reserved() const;
+};
+
+// A file opened for writing, either from the start replacing any existing
+// file, or appending to the end of an existing one
+class output_file {
+	int fd;
+	size_t offset;
+	std::string fname;
+
+public:
+	output_file(const std::string &fname, const bool append = false);
+	~output_file();
+	output_file(const output_file &) = delete;
+	output_file& operator=(const output_file &) = delete;
+
+	// Append n bytes to the end of the file
+	void write(const char *data, const size_t n);
+};
+
+// A file written at explicit offsets, replacing any existing file. Writes to
+// non-overlapping ranges of the file can be made concurrently from multiple threads.
+// If direct is set an O_DIRECT descriptor is also opened for write_padded to use,
+// if the file system supports it.
+class positional_file {
+	int fd;
+	int direct_fd;
+	std::string fname;
+
+public:
+	positional_file(const std::string &fname, const bool direct = false);
+	~positional_file();
+	positional_file(const positional_file &) = delete;
+	positional_file& operator=(const positional_file &) = delete;
+
+	// Write n bytes of data at offset in the file
+	void write(const char *data, const size_t n, const uint64_t offset);
+	// Write the buffer at offset, which must be a multiple of DIRECT_IO_ALIGNMENT. The
+	// buffer is padded with zeros out to the alignment and written with O_DIRECT
+	// if available, returns the number of bytes written including the padding
+	size_t write_padded(aligned_buffer &buf, const uint64_t offset);
+	// Set the size of the file, e.g. to trim padding from the last write
+	void truncate(const uint64_t size);
+	bool direct() const;
+};
+
+// Write the buffer out to the file, replacing any existing file. The data is written
+// with as few pwrite calls as possible. If direct is set the file is opened with O_DIRECT
+// to bypass the page cache, falling back to buffered writes if the file system doesn't
+// support it. Direct writes pad the buffer with zeros out to its reserved size.
+void write_file(const std::string &fname, aligned_buffer &buf, const bool direct);
+
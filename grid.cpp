@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include "tbb/tbb.h"
+#include "grid.h"
+
+// Padding applied to the candidate cell range, in units of cells
+const float CELL_RANGE_PADDING = 1e-3f;
+
+uniform_grid::uniform_grid(const vec3sz &dims, const box3f &bounds)
+	: dims(dims), bounds(bounds), brick_size((bounds.upper - bounds.lower) / vec3f(dims))
+{}
+size_t uniform_grid::num_cells() const {
+	return dims.x * dims.y * dims.z;
+}
+vec3sz uniform_grid::cell_index(const size_t i) const {
+	return vec3sz(i % dims.x, (i / dims.x) % dims.y, i / (dims.x * dims.y));
+}
+size_t uniform_grid::cell_id(const vec3sz &idx) const {
+	return idx.x + dims.x * (idx.y + dims.y * idx.z);
+}
+box3f uniform_grid::cell_bounds(const size_t i) const {
+	const vec3sz idx = cell_index(i);
+	const vec3f blower(
+			rescale_value(idx.x, 0, dims.x, bounds.lower.x, bounds.upper.x),
+			rescale_value(idx.y, 0, dims.y, bounds.lower.y, bounds.upper.y),
+			rescale_value(idx.z, 0, dims.z, bounds.lower.z, bounds.upper.z));
+	// Compute the upper corner the same way as the next cell's lower corner so
+	// neighboring cells share exactly the same faces
+	const vec3f bupper(
+			rescale_value(idx.x + 1, 0, dims.x, bounds.lower.x, bounds.upper.x),
+			rescale_value(idx.y + 1, 0, dims.y, bounds.lower.y, bounds.upper.y),
+			rescale_value(idx.z + 1, 0, dims.z, bounds.lower.z, bounds.upper.z));
+	return box3f(blower, bupper);
+}
+size_t uniform_grid::cell_containing(const vec3f &p) const {
+	const std::array<size_t, 3> n{dims.x, dims.y, dims.z};
+	std::array<size_t, 3> idx;
+	for (int i = 0; i < 3; ++i) {
+		const float f = brick_size[i] > 0.f ? std::floor((p[i] - bounds.lower[i]) / brick_size[i]) : 0.f;
+		idx[i] = f < 0.f ? 0 : std::min(static_cast<size_t>(f), n[i] - 1);
+	}
+	return cell_id(vec3sz(idx[0], idx[1], idx[2]));
+}
+void uniform_grid::overlapped_cells(const box3f &b, vec3sz &lo, vec3sz &hi) const {
+	const std::array<float, 3> blo{b.lower.x, b.lower.y, b.lower.z};
+	const std::array<float, 3> bhi{b.upper.x, b.upper.y, b.upper.z};
+	const std::array<float, 3> glo{bounds.lower.x, bounds.lower.y, bounds.lower.z};
+	const std::array<float, 3> size{brick_size.x, brick_size.y, brick_size.z};
+	const std::array<size_t, 3> n{dims.x, dims.y, dims.z};
+	std::array<size_t, 3> l, h;
+	for (size_t i = 0; i < 3; ++i) {
+		// A flat grid axis can't be used to cull anything
+		if (!(size[i] > 0.f)) {
+			l[i] = 0;
+			h[i] = n[i] - 1;
+			continue;
+		}
+		const float fl = std::floor((blo[i] - glo[i]) / size[i] - CELL_RANGE_PADDING);
+		const float fh = std::floor((bhi[i] - glo[i]) / size[i] + CELL_RANGE_PADDING);
+		l[i] = fl < 0.f ? 0 : std::min(static_cast<size_t>(fl), n[i] - 1);
+		h[i] = fh < 0.f ? 0 : std::min(static_cast<size_t>(fh), n[i] - 1);
+	}
+	lo = vec3sz(l[0], l[1], l[2]);
+	hi = vec3sz(h[0], h[1], h[2]);
+}
+
+// Triangles are binned as (id << 1) | needs_test, where needs_test marks
+// candidates that still need the exact test against the cell
+const size_t NEEDS_TEST = 1;
+const size_t REJECTED = std::numeric_limits<size_t>::max();
+
+std::vector<std::vector<size_t>> bin_triangles(const uniform_grid &grid, const mesh_view &mesh,
+		sat_counters *counters, const float ghost_width)
+{
+	const vec3f ghost(std::max(ghost_width, 0.f));
+	using cell_lists = std::vector<std::vector<size_t>>;
+	const size_t ncells = grid.num_cells();
+	const size_t ntris = mesh.num_tris;
+
+	// Each thread bins the triangles it sees into its own set of lists, which
+	// are merged per-cell afterwards
+	tbb::enumerable_thread_specific<cell_lists> thread_cells([&]() { return cell_lists(ncells); });
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, ntris),
+		[&](const tbb::blocked_range<size_t> &r) {
+			cell_lists &cells = thread_cells.local();
+			for (size_t f = r.begin(); f != r.end(); ++f) {
+				const std::array<vec3f, 3> tri = mesh.triangle(f);
+				box3f tri_bounds;
+				for (const auto &p : tri) {
+					tri_bounds.extend(p);
+				}
+				tri_bounds.lower = tri_bounds.lower - ghost;
+				tri_bounds.upper = tri_bounds.upper + ghost;
+				vec3sz lo, hi;
+				grid.overlapped_cells(tri_bounds, lo, hi);
+				// If the triangle's bounds are entirely within one cell it must
+				// touch that cell, and we can skip the exact test. The same holds
+				// for the grown bounds and cells when there's a ghost layer
+				const size_t needs_test = lo == hi ? 0 : NEEDS_TEST;
+				for (size_t z = lo.z; z <= hi.z; ++z) {
+					for (size_t y = lo.y; y <= hi.y; ++y) {
+						for (size_t x = lo.x; x <= hi.x; ++x) {
+							cells[grid.cell_id(vec3sz(x, y, z))].push_back((f << 1) | needs_test);
+						}
+					}
+				}
+			}
+		});
+
+	cell_lists cells(ncells);
+	tbb::enumerable_thread_specific<sat_counters> thread_counters;
+	tbb::parallel_for(size_t(0), ncells, size_t(1),
+		[&](const size_t i) {
+			std::vector<size_t> &tris = cells[i];
+			size_t count = 0;
+			for (const auto &tc : thread_cells) {
+				count += tc[i].size();
+			}
+			tris.reserve(count);
+			for (auto &tc : thread_cells) {
+				tris.insert(tris.end(), tc[i].begin(), tc[i].end());
+				std::vector<size_t>().swap(tc[i]);
+			}
+			std::sort(tris.begin(), tris.end());
+
+			// Run the exact test on the candidates in batches
+			box3f bounds = grid.cell_bounds(i);
+			bounds.lower = bounds.lower - ghost;
+			bounds.upper = bounds.upper + ghost;
+			sat_counters *cell_counters = counters ? &thread_counters.local() : nullptr;
+			triangle_batch batch;
+			std::array<size_t, TRIANGLE_BATCH_SIZE> batch_slots;
+			auto test_batch = [&]() {
+				const uint32_t mask = triangle_box_intersection(batch, bounds, cell_counters);
+				for (size_t k = 0; k < batch.count; ++k) {
+					if (!(mask & (1u << k))) {
+						tris[batch_slots[k]] = REJECTED;
+					}
+				}
+				batch.count = 0;
+			};
+			for (size_t j = 0; j < tris.size(); ++j) {
+				if (tris[j] & NEEDS_TEST) {
+					const std::array<vec3f, 3> tri = mesh.triangle(tris[j] >> 1);
+					batch_slots[batch.push_back(tri[0], tri[1], tri[2])] = j;
+					if (batch.full()) {
+						test_batch();
+					}
+				} else if (cell_counters) {
+					++cell_counters->untested;
+				}
+			}
+			test_batch();
+
+			size_t n = 0;
+			for (const auto &t : tris) {
+				if (t != REJECTED) {
+					tris[n++] = t >> 1;
+				}
+			}
+			tris.resize(n);
+		});
+	if (counters) {
+		for (const auto &c : thread_counters) {
+			*counters += c;
+		}
+	}
+	return cells;
+}
+
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "math.h"
+#include "mesh.h"
+
+// A uniform grid of bricks covering some bounding box
+struct uniform_grid {
+	vec3sz dims;
+	box3f bounds;
+	vec3f brick_size;
+
+	uniform_grid(const vec3sz &dims, const box3f &bounds);
+	size_t num_cells() const;
+	vec3sz cell_index(const size_t i) const;
+	size_t cell_id(const vec3sz &idx) const;
+	box3f cell_bounds(const size_t i) const;
+	// Find the cell containing the point, points outside the grid are clamped to
+	// the nearest cell. Each point is in exactly one cell, which makes this suitable
+	// for assigning triangles to a single owning cell by their centroid
+	size_t cell_containing(const vec3f &p) const;
+	// Find the inclusive range of cells which may overlap the box. The range
+	// is padded slightly so that boxes touching a cell boundary are reported
+	// in both neighboring cells, the exact test is left to the caller
+	void overlapped_cells(const box3f &b, vec3sz &lo, vec3sz &hi) const;
+};
+
+// Bin the triangles of the mesh into the grid cells they intersect. Each triangle's
+// bounds are used to find the candidate cells, and only those candidates are
+// tested against the exact triangle/box intersection. Returns the list of triangle
+// IDs touching each cell, sorted by triangle ID. If counters is passed the exact
+// tests run while binning are added to it. If ghost_width is positive each cell is
+// grown by ghost_width on every side, so it also gets the triangles within that
+// distance of it.
+std::vector<std::vector<size_t>> bin_triangles(const uniform_grid &grid, const mesh_view &mesh,
+		sat_counters *counters = nullptr, const float ghost_width = 0.f);
+
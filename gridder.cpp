@@ -1,181 +1,598 @@
 #include <iostream>
-#include <set>
-#include <unordered_map>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <array>
+#include <memory>
+#include <functional>
+#include <atomic>
 #include "tbb/tbb.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "tiny_obj_loader.h"
-
 #include "math.h"
-
-void write_obj_brick(const std::vector<float> &verts, const std::vector<uint64_t> indices,
-		const std::vector<size_t> &tris, const std::string &fname, const bool write_binary);
+#include "mesh.h"
+#include "obj_parser.h"
+#include "grid.h"
+#include "brick.h"
+#include "brick_writer.h"
+#include "out_of_core.h"
+#include "distributed.h"
+#include "stats.h"
+#include "adaptive.h"
+#include "manifest.h"
+#include "brick_pack.h"
+#include "reorder.h"
+#include "morton.h"
+#include "clip.h"
+#include "isosurface.h"
 
 int main(int argc, char **argv) {
-	if (argc != 6 || std::strcmp(argv[1], "-h") == 0) {
-		std::cout << "Usage: " << argv[0] << " <in.obj> <x> <y> <z> <output prefix>\n"
+	if (argc == 4 && std::strcmp(argv[1], "-coordinator") == 0) {
+		try {
+			run_coordinator(std::atoi(argv[2]), std::atoll(argv[3]));
+		} catch (const std::runtime_error &e) {
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+	if (argc < 6 || std::strcmp(argv[1], "-h") == 0) {
+		std::cout << "Usage: " << argv[0] << " <in.obj> <x> <y> <z> <output prefix> [options]\n"
 			<< "    The input OBJ file will be gridded onto an <x>*<y>*<z> grid\n"
 			<< "    each grid cell will then be output as <output prefix>#.obj\n"
-			<< "    where # indicates the grid cell id.\n";
+			<< "    where # indicates the grid cell id. Empty cells are skipped, the\n"
+			<< "    bounds and triangle counts of the bricks written are listed in\n"
+			<< "    <output prefix>manifest.txt (<output prefix>manifest_<rank>.txt\n"
+			<< "    for each distributed worker).\n"
+			<< "    A raw volume named <name>_<X>x<Y>x<Z>_<data type>.raw can be given instead\n"
+			<< "    of a mesh along with -iso, each brick's isosurface is then extracted from its\n"
+			<< "    block of the volume and written directly as a .bobj brick.\n"
+			<< "Options:\n"
+			<< "    -weld <eps>    Weld vertices within <eps> of each other in each brick.\n"
+			<< "                   By default only vertices shared by index are merged,\n"
+			<< "                   an <eps> of 0 welds vertices with identical positions.\n"
+			<< "    -direct        Write binary bricks with O_DIRECT, bypassing the page cache.\n"
+			<< "    -bobj2         Write version 2 .bobj bricks, which store the indices of each\n"
+			<< "                   brick with the narrowest of 16, 32 or 64 bits and the brick's\n"
+			<< "                   bounds in the header.\n"
+			<< "    -quantize <bits>\n"
+			<< "                   Write version 2 .bobj bricks with the vertices quantized to\n"
+			<< "                   <bits> (at most 16) per component relative to the brick bounds.\n"
+			<< "    -compress      Write compressed version 2 .bobj bricks. The triangles of each\n"
+			<< "                   brick are reordered for vertex cache locality, then the vertex\n"
+			<< "                   and index streams are delta coded with Stream VByte.\n"
+			<< "    -reorder <tipsify|forsyth>\n"
+			<< "                   Reorder the triangles of each brick for vertex cache locality\n"
+			<< "                   with Tipsify or Forsyth's algorithm, then number the vertices\n"
+			<< "                   in the order they're first used. Compressed bricks are\n"
+			<< "                   reordered with Tipsify unless another method is given.\n"
+			<< "    -owner         Assign each triangle to the single brick containing its centroid.\n"
+			<< "                   Each brick's owned triangles are written first, followed by\n"
+			<< "                   the ghost triangles it shares with the bricks owning them. OBJ\n"
+			<< "                   bricks put them in \"owned\" and \"ghost\" groups, .bobj bricks\n"
+			<< "                   are written as version 2 with the owned count in the header.\n"
+			<< "                   The manifest lists the owned count of each brick.\n"
+			<< "    -ghost <width> Also include the triangles within <width> of each brick as\n"
+			<< "                   ghost triangles, implies -owner.\n"
+			<< "    -clip          Clip the triangles crossing each brick's bounds to the bounds,\n"
+			<< "                   instead of writing them whole into every brick they touch.\n"
+			<< "                   The new vertices on the brick faces are shared exactly by the\n"
+			<< "                   bricks on either side.\n"
+			<< "    -morton        Sort the triangles by the Morton code of their centroids and\n"
+			<< "                   renumber the vertices to match before gridding, so the\n"
+			<< "                   triangles of each brick are close together in memory.\n"
+			<< "    -ooc <MB> <scratch dir>\n"
+			<< "                   Grid out of core for meshes larger than memory, using about\n"
+			<< "                   <MB> megabytes of memory and spilling binned triangles to\n"
+			<< "                   files in <scratch dir>. Requires a .bobj input mesh that can\n"
+			<< "                   be read in place, an original .bobj or a version 2 .bobj\n"
+			<< "                   without quantization, compression or narrow indices.\n"
+			<< "    -worker <rank> <nranks> <host:port>\n"
+			<< "                   Run as one of <nranks> workers of a distributed job, connecting\n"
+			<< "                   to the coordinator at <host:port>. Each worker bins a slice of\n"
+			<< "                   the triangles and writes the bricks with id % <nranks> == <rank>.\n"
+			<< "    -adaptive <max tris>\n"
+			<< "                   Split each grid cell at the median triangle along its longest\n"
+			<< "                   axis until each brick has at most <max tris> triangles. Empty\n"
+			<< "                   bricks are skipped and the bricks' bounds are written to\n"
+			<< "                   <output prefix>manifest.txt. Use a 1 1 1 grid to split the\n"
+			<< "                   whole mesh adaptively.\n"
+			<< "    -adaptive-bytes <max bytes>\n"
+			<< "                   Split adaptively like -adaptive until each brick's estimated\n"
+			<< "                   size in the output format is at most <max bytes>. The size of\n"
+			<< "                   compressed bricks is estimated uncompressed and OBJ bricks from\n"
+			<< "                   a typical line length. Can be combined with -adaptive.\n"
+			<< "    -pack          Write all the bricks into a single file, <output prefix>bricks.pack\n"
+			<< "                   (<output prefix>bricks_<rank>.pack for distributed workers),\n"
+			<< "                   with a table giving the offset and size of each brick.\n"
+			<< "    -iso <value>   Extract the isosurface at <value> from the raw volume input, can\n"
+			<< "                   be given more than once. The volume's cells are split evenly\n"
+			<< "                   between the bricks, neighboring bricks share the voxels on\n"
+			<< "                   the face between them and the bounds are in voxel coordinates.\n"
+			<< "    -stats <file>  Write the stage timings and counters of the run to <file> as JSON.\n"
+			<< "Distributed jobs are coordinated by a process run as:\n"
+			<< "    " << argv[0] << " -coordinator <port> <nranks>\n";
+		return 1;
 	}
 
-	const std::string infile = argv[1];
-	const bool write_binary = infile.substr(infile.size() - 4) == "bobj";
-
-    std::vector<uint64_t> indices;
-    std::vector<float> verts;
-	if (!write_binary) {
-		// Load the OBJ file
-		tinyobj::attrib_t attrib;
-		std::vector<tinyobj::shape_t> shapes;
-		std::vector<tinyobj::material_t> materials;
-		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, argv[1]);
-		if (!ret) {
-			std::cout << "Error loading mesh: " << err << std::endl;
+	float weld_epsilon = -1.f;
+	bool direct_io = false;
+	bool bobj_v2 = false;
+	uint32_t quant_bits = 0;
+	bool compress = false;
+	bool reorder = false;
+	reorder_method reorder_with = reorder_method::TIPSIFY;
+	bool morton = false;
+	bool ownership = false;
+	bool clip = false;
+	float ghost_width = 0.f;
+	bool out_of_core = false;
+	out_of_core_options ooc_options;
+	bool distributed = false;
+	size_t worker_rank = 0;
+	size_t worker_nranks = 1;
+	std::string coordinator;
+	std::string stats_file;
+	bool adaptive = false;
+	adaptive_options adaptive_opts;
+	bool packed = false;
+	std::vector<float> isovalues;
+	for (int i = 6; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-weld") == 0 && i + 1 < argc) {
+			weld_epsilon = std::atof(argv[++i]);
+		} else if (std::strcmp(argv[i], "-direct") == 0) {
+			direct_io = true;
+		} else if (std::strcmp(argv[i], "-bobj2") == 0) {
+			bobj_v2 = true;
+		} else if (std::strcmp(argv[i], "-compress") == 0) {
+			bobj_v2 = true;
+			compress = true;
+		} else if (std::strcmp(argv[i], "-reorder") == 0 && i + 1 < argc) {
+			reorder = true;
+			++i;
+			if (std::strcmp(argv[i], "tipsify") == 0) {
+				reorder_with = reorder_method::TIPSIFY;
+			} else if (std::strcmp(argv[i], "forsyth") == 0) {
+				reorder_with = reorder_method::FORSYTH;
+			} else {
+				std::cout << "Error: unrecognized reorder method " << argv[i] << "\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "-quantize") == 0 && i + 1 < argc) {
+			bobj_v2 = true;
+			quant_bits = std::atoi(argv[++i]);
+			if (quant_bits == 0 || quant_bits > BOBJ_MAX_QUANT_BITS) {
+				std::cout << "Error: -quantize requires between 1 and " << BOBJ_MAX_QUANT_BITS << " bits\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "-owner") == 0) {
+			ownership = true;
+		} else if (std::strcmp(argv[i], "-ghost") == 0 && i + 1 < argc) {
+			ownership = true;
+			ghost_width = std::atof(argv[++i]);
+			if (!(ghost_width >= 0.f)) {
+				std::cout << "Error: -ghost requires a non-negative width\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "-clip") == 0) {
+			clip = true;
+		} else if (std::strcmp(argv[i], "-morton") == 0) {
+			morton = true;
+		} else if (std::strcmp(argv[i], "-ooc") == 0 && i + 2 < argc) {
+			out_of_core = true;
+			ooc_options.memory_budget = std::atoll(argv[++i]) * size_t(1024 * 1024);
+			ooc_options.scratch_dir = argv[++i];
+		} else if (std::strcmp(argv[i], "-worker") == 0 && i + 3 < argc) {
+			distributed = true;
+			worker_rank = std::atoll(argv[++i]);
+			worker_nranks = std::atoll(argv[++i]);
+			coordinator = argv[++i];
+		} else if (std::strcmp(argv[i], "-adaptive") == 0 && i + 1 < argc) {
+			adaptive = true;
+			adaptive_opts.max_tris = std::atoll(argv[++i]);
+			if (adaptive_opts.max_tris == 0) {
+				std::cout << "Error: -adaptive requires a positive triangle count\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "-adaptive-bytes") == 0 && i + 1 < argc) {
+			adaptive = true;
+			adaptive_opts.max_bytes = std::atoll(argv[++i]);
+			if (adaptive_opts.max_bytes == 0) {
+				std::cout << "Error: -adaptive-bytes requires a positive size\n";
+				return 1;
+			}
+		} else if (std::strcmp(argv[i], "-pack") == 0) {
+			packed = true;
+		} else if (std::strcmp(argv[i], "-iso") == 0 && i + 1 < argc) {
+			isovalues.push_back(std::atof(argv[++i]));
+		} else if (std::strcmp(argv[i], "-stats") == 0 && i + 1 < argc) {
+			stats_file = argv[++i];
+		} else {
+			std::cout << "Error: unrecognized option " << argv[i] << "\n";
 			return 1;
 		}
+	}
 
-		if (shapes.size() > 1) {
-			std::cout << "Error: OBJ file must contain a single object/group\n";
+	const std::string infile = argv[1];
+	// Bricks extracted from a volume are always written as .bobj files
+	const bool volume_input = infile.size() > 4 && infile.substr(infile.size() - 4) == ".raw";
+	const bool write_binary = volume_input || infile.substr(infile.size() - 4) == "bobj";
+	if (volume_input != !isovalues.empty()) {
+		std::cout << "Error: a raw volume input requires -iso, which requires a raw volume input\n";
+		return 1;
+	}
+	if (volume_input && (out_of_core || distributed || adaptive || morton || ghost_width > 0.f)) {
+		std::cout << "Error: isosurface extraction can't be combined with out of core, distributed"
+			<< " or adaptive gridding, -morton or -ghost\n";
+		return 1;
+	}
+	if (out_of_core && !write_binary) {
+		std::cout << "Error: out of core gridding requires a .bobj input mesh\n";
+		return 1;
+	}
+	if (bobj_v2 && !write_binary) {
+		std::cout << "Error: version 2 .bobj output requires a .bobj input mesh\n";
+		return 1;
+	}
+	if (adaptive && ghost_width > 0.f) {
+		std::cout << "Error: adaptive bricking can't be combined with a ghost layer\n";
+		return 1;
+	}
+	if (clip && ownership) {
+		std::cout << "Error: clipped bricks own all their triangles, -clip can't be combined with"
+			<< " -owner or -ghost\n";
+		return 1;
+	}
+	// Only version 2 .bobj files can store the owned triangle count
+	if (ownership && write_binary) {
+		bobj_v2 = true;
+	}
+	if (out_of_core && morton) {
+		std::cout << "Error: out of core gridding can't sort the mesh in memory with -morton\n";
+		return 1;
+	}
+	if (out_of_core && distributed) {
+		std::cout << "Error: out of core gridding can't be run distributed\n";
+		return 1;
+	}
+	if (adaptive && (out_of_core || distributed)) {
+		std::cout << "Error: adaptive bricking can't be combined with out of core or distributed gridding\n";
+		return 1;
+	}
+	if (distributed && worker_rank >= worker_nranks) {
+		std::cout << "Error: worker rank must be less than the number of ranks\n";
+		return 1;
+	}
+
+	gridder_stats stats;
+	std::vector<uint64_t> indices;
+	std::vector<float> verts;
+	std::unique_ptr<bobj_file> bobj;
+	mesh_view mesh;
+	// The bounds are found while parsing OBJ files, and are stored in
+	// the header of version 2 .bobj files
+	box3f model_bounds;
+	bool have_bounds = false;
+	// Raw volumes are mapped, and each brick's block of voxels read in place
+	std::unique_ptr<mapped_file> volume_file;
+	raw_volume_info volume_info;
+	try {
+		stats.time("load", [&]() {
+			if (volume_input) {
+				volume_info = parse_raw_volume_name(infile);
+				volume_file = std::make_unique<mapped_file>(infile);
+				if (volume_file->size() < volume_info.num_voxels() * voxel_size(volume_info.type)) {
+					throw std::runtime_error("Raw volume is smaller than its dimensions");
+				}
+				const std::array<size_t, 3> &d = volume_info.dims;
+				model_bounds = box3f(vec3f(0.f), vec3f(d[0] - 1.f, d[1] - 1.f, d[2] - 1.f));
+				have_bounds = true;
+			} else if (!write_binary) {
+				load_obj(infile, verts, indices, &model_bounds);
+				mesh = mesh_view(verts, indices);
+				have_bounds = true;
+			} else {
+				// Work directly on the mapped file, no copy of the mesh is made. Out
+				// of core gridding only works within its memory budget if the file
+				// isn't decoded into memory
+				bobj = std::make_unique<bobj_file>(infile, out_of_core);
+				mesh = bobj->mesh;
+				model_bounds = bobj->bounds;
+				have_bounds = bobj->has_bounds;
+			}
+		});
+	} catch (const std::runtime_error &e) {
+		std::cout << "Error loading mesh: " << e.what() << std::endl;
+		return 1;
+	}
+	stats.num_verts = mesh.num_verts;
+	stats.num_tris = mesh.num_tris;
+
+	std::unique_ptr<worker_connection> worker;
+	if (distributed) {
+		try {
+			stats.time("connect", [&]() {
+				worker = std::make_unique<worker_connection>(coordinator, worker_rank, worker_nranks);
+			});
+		} catch (const std::runtime_error &e) {
+			std::cout << "Error: " << e.what() << std::endl;
 			return 1;
 		}
+	}
 
-		const auto &shape = shapes[0];
-		// Need to build the index buffer ourselves
-		for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); ++f) {
-			int fv = shape.mesh.num_face_vertices[f];
-			if (fv != 3) {
-				std::cout << "Error: only triangle meshes are supported\n" << std::flush;
-				std::exit(1);
+	// Distributed workers each find the bounds of a slice of the vertices. Workers
+	// which already have the bounds still take part in the reduction, which the
+	// coordinator waits on
+	size_t verts_begin = 0;
+	size_t verts_end = mesh.num_verts;
+	if (worker) {
+		worker->slice(mesh.num_verts, verts_begin, verts_end);
+	}
+	if (!have_bounds || worker) {
+		stats.time("bounds", [&]() {
+			if (!have_bounds) {
+				model_bounds = mesh_bounds(mesh, verts_begin, verts_end);
 			}
-			// Loop over vertices in the face.
-			for (size_t v = 0; v < 3; ++v) {
-				indices.push_back(shape.mesh.indices[f * 3 + v].vertex_index);
+			if (worker) {
+				model_bounds = worker->reduce_bounds(model_bounds);
 			}
-		}
-		verts = std::move(attrib.vertices);
-	} else {
-      std::ifstream fin(infile.c_str(), std::ios::binary);
-      uint64_t header[2] = {0};
-      fin.read(reinterpret_cast<char*>(header), sizeof(header));
-      verts.resize(header[0] * 3, 0.f);
-      fin.read(reinterpret_cast<char*>(verts.data()), sizeof(float) * 3 * header[0]);
-	  indices.resize(header[1] * 3, 0);
-      fin.read(reinterpret_cast<char*>(indices.data()), sizeof(uint64_t) * 3 * header[1]);
+		});
 	}
 
-	box3f model_bounds;
-	for (size_t i = 0; i < verts.size() / 3; ++i) {
-		vec3f p(verts[3 * i], verts[3 * i + 1], verts[3 * i + 2]);
-		model_bounds.extend(p);
+	if (morton) {
+		// Each worker sorts the whole mesh, giving all workers the same triangle IDs
+		stats.time("morton", [&]() {
+			std::vector<float> sorted_verts;
+			std::vector<uint64_t> sorted_indices;
+			morton_order(mesh, model_bounds, sorted_verts, sorted_indices);
+			verts.swap(sorted_verts);
+			indices.swap(sorted_indices);
+			mesh = mesh_view(verts, indices);
+			bobj.reset();
+		});
 	}
 
 	// Setup grid structure (a list of which triangle IDs touch the cell)
-	const vec3sz grid(std::atoll(argv[2]), std::atoll(argv[3]), std::atoll(argv[4]));
-	const vec3f brick_size = (model_bounds.upper - model_bounds.lower) / vec3f(grid);
-	const size_t ncells = grid.x * grid.y * grid.z;
+	const vec3sz grid_dims(std::atoll(argv[2]), std::atoll(argv[3]), std::atoll(argv[4]));
+	const uniform_grid grid(grid_dims, model_bounds);
+	const size_t ncells = grid.num_cells();
 	std::cout << "Bounds of model: " << model_bounds << "\n"
-		<< "Grid to " << grid << " dim grid\n"
-		<< "Brick size = " << brick_size << "\n";
-
-	tbb::parallel_for(size_t(0), ncells, size_t(1),
-		[&](const size_t i) {
-			const vec3sz idx(i % grid.x, (i / grid.x) % grid.y, i / (grid.x * grid.y));
-			const vec3f blower(
-					rescale_value(idx.x, 0, grid.x, model_bounds.lower.x, model_bounds.upper.x),
-					rescale_value(idx.y, 0, grid.y, model_bounds.lower.y, model_bounds.upper.y),
-					rescale_value(idx.z, 0, grid.z, model_bounds.lower.z, model_bounds.upper.z));
-			const box3f brick_bounds(blower, blower + brick_size);
-
-			std::vector<size_t> contained_tris;
-			// Loop through the mesh and see which triangles are contained in this grid cell
-			for (size_t f = 0; f < indices.size() / 3; ++f) {
-				std::array<vec3f, 3> tri;
-				for (size_t v = 0; v < 3; ++v) {
-					tri[v].x = verts[3 * indices[3 * f + v]];
-					tri[v].y = verts[3 * indices[3 * f + v] + 1];
-					tri[v].z = verts[3 * indices[3 * f + v] + 2];
-				}
-				if (triangle_box_intersection(tri[0], tri[1], tri[2], brick_bounds)) {
-					contained_tris.push_back(f);
-				}
+		<< "Grid to " << grid.dims << " dim grid\n"
+		<< "Brick size = " << grid.brick_size << "\n";
+	stats.grid_dims = grid.dims;
+	stats.brick_tris.resize(ncells, gridder_stats::NOT_WRITTEN);
+	std::vector<uint64_t> brick_owned(ncells, 0);
 
-			}
-			// Need to now save out the OBJ files. To do so, we need to take
-			// just the vertices that we have for the cell, remap the indices and write
-			// out the file
-			std::string fname = argv[5] + std::to_string(i);
+	// Files written by distributed workers are suffixed with their rank
+	const std::string rank_suffix = worker ? "_" + std::to_string(worker_rank) : "";
+	std::function<box3f(size_t)> brick_bounds = [&](const size_t i) { return grid.cell_bounds(i); };
+	std::unique_ptr<brick_pack_writer> pack;
+	auto open_pack = [&](const size_t num_bricks) {
+		try {
+			pack = std::make_unique<brick_pack_writer>(argv[5] + std::string("bricks") + rank_suffix + ".pack",
+					write_binary ? pack_format::BOBJ : pack_format::OBJ, num_bricks, direct_io);
+		} catch (const std::runtime_error &e) {
+			std::cout << "Error: " << e.what() << std::endl;
+			return false;
+		}
+		return true;
+	};
+
+	tbb::enumerable_thread_specific<brick_clipper> clippers;
+	tbb::enumerable_thread_specific<brick_reorderer> reorderers;
+	tbb::enumerable_thread_specific<brick_writer> writers;
+	// Need to now save out the OBJ files. To do so, we need to take
+	// just the vertices that we have for the cell, remap the indices and write
+	// out the file
+	auto output_brick = [&](const size_t i, const mesh_brick &built_brick) {
+		const mesh_brick &clipped_brick = clip && built_brick.num_tris() != 0
+			? clippers.local().clip(built_brick, brick_bounds(i)) : built_brick;
+		stats.brick_tris[i] = clipped_brick.num_tris();
+		brick_owned[i] = clipped_brick.num_owned;
+		if (clipped_brick.num_tris() == 0) {
+			return;
+		}
+		// Compression relies on the triangles and vertices being in cache order
+		const mesh_brick &brick = reorder || compress
+			? reorderers.local().reorder(clipped_brick, reorder_with) : clipped_brick;
+		brick_writer &writer = writers.local();
+		writer.direct_io = direct_io;
+		writer.bobj_v2 = bobj_v2;
+		writer.quant_bits = quant_bits;
+		writer.compress = compress;
+		writer.ownership = ownership;
+		if (pack) {
 			if (!write_binary) {
-				fname += ".obj";
+				writer.encode_obj(brick);
 			} else {
-				fname += ".bobj";
-			}
-			write_obj_brick(verts, indices, contained_tris, fname, write_binary);
-		});
-
-	return 0;
-}
-void write_obj_brick(const std::vector<float> &verts, const std::vector<uint64_t> indices,
-		const std::vector<size_t> &tris, const std::string &fname, const bool write_binary)
-{
-	std::ofstream fout;
-	if (!write_binary) {
-		fout.open(fname.c_str());
-	} else {
-		fout.open(fname.c_str(), std::ios::binary);
-		uint64_t header[2] = {0};
-		fout.write(reinterpret_cast<char*>(header), sizeof(header));
-	}
-	size_t next_vert_id = 1;
-	std::unordered_map<uint64_t, uint64_t> vertex_remapping;
-	std::map<vec3f, uint64_t> remapped_verts;
-
-	for (const auto &t : tris) {
-		for (size_t v = 0; v < 3; ++v) {
-			const uint64_t vert_idx = indices[3 * t + v];
-			vec3f vert(verts[3 * vert_idx], verts[3 * vert_idx + 1], verts[3 * vert_idx + 2]);
-
-			if (remapped_verts.find(vert) == remapped_verts.end()) {
-				remapped_verts[vert] = next_vert_id;
-
-				if (!write_binary) {
-					fout << "v " << vert.x << " " << vert.y << " " << vert.z << "\n";
-				} else {
-					fout.write(reinterpret_cast<const char*>(&vert), sizeof(vert));
-				}
-
-				++next_vert_id;
+				writer.encode_bobj(brick);
 			}
-			vertex_remapping[vert_idx] = remapped_verts[vert];
-		}
-	}
-	const uint64_t n_verts_written = next_vert_id - 1;
-	uint64_t n_indices_written = 0;
-	for (const auto &t : tris) {
-		std::array<uint64_t, 3> tids;
-		for (size_t v = 0; v < 3; ++v) {
-			const uint64_t vert_idx = indices[3 * t + v];
-			tids[v] = vertex_remapping[vert_idx];
+			writer.bytes_written += pack->write(i, brick_bounds(i), brick.num_tris(), writer.buffer);
+			return;
 		}
+		std::string fname = argv[5] + std::to_string(i);
 		if (!write_binary) {
-			fout << "f " << tids[0] << " " << tids[1] << " " << tids[2] << "\n";
+			writer.write_obj(brick, fname + ".obj");
 		} else {
-			for (uint64_t &x : tids) {
-				x -= 1;
+			writer.write_bobj(brick, fname + ".bobj");
+		}
+	};
+	// Finish the pack, list the non-empty bricks written by this process in the
+	// manifest and report the stats once all the bricks are out
+	auto finish_output = [&]() {
+		std::vector<brick_info> manifest;
+		for (size_t i = 0; i < stats.brick_tris.size(); ++i) {
+			if (stats.brick_tris[i] != gridder_stats::NOT_WRITTEN && stats.brick_tris[i] != 0) {
+				brick_info b;
+				b.id = i;
+				b.bounds = brick_bounds(i);
+				b.num_tris = stats.brick_tris[i];
+				b.num_owned = brick_owned[i];
+				manifest.push_back(b);
 			}
-			fout.write(reinterpret_cast<char*>(tids.data()), sizeof(uint64_t) * tids.size());
 		}
-		++n_indices_written;
+		try {
+			if (pack) {
+				pack->finish();
+			}
+			write_manifest(argv[5] + std::string("manifest") + rank_suffix + ".txt", manifest);
+		} catch (const std::runtime_error &e) {
+			std::cout << "Error: " << e.what() << std::endl;
+			return false;
+		}
+
+		for (const auto &w : writers) {
+			stats.bytes_written += w.bytes_written;
+		}
+		stats.print_summary(std::cout);
+		if (!stats_file.empty()) {
+			std::ofstream fout(stats_file.c_str());
+			stats.write_json(fout);
+		}
+		return true;
+	};
+	if (volume_input) {
+		const volume_grid vgrid(volume_info.dims, grid_dims);
+		brick_bounds = [&](const size_t i) { return vgrid.brick_bounds(i); };
+		if (packed && !open_pack(ncells)) {
+			return 1;
+		}
+		volume_view volume;
+		volume.data = volume_file->data();
+		volume.type = volume_info.type;
+		volume.dims = volume_info.dims;
+
+		std::atomic<uint64_t> num_verts(0);
+		std::atomic<uint64_t> num_tris(0);
+		tbb::enumerable_thread_specific<brick_builder> builders;
+		stats.time("output", [&]() {
+			tbb::parallel_for(size_t(0), ncells, size_t(1),
+				[&](const size_t i) {
+					std::array<size_t, 3> begin, end;
+					vgrid.brick_cells(i, begin, end);
+					// The extraction runs in parallel itself, so its mesh can't be
+					// a thread local another task on this thread could pick up
+					mesh_brick extracted;
+					std::vector<uint64_t> vertex_edges;
+					extract_isosurface(volume, begin, end, isovalues, extracted, &vertex_edges);
+					num_tris += extracted.num_tris();
+					if (extracted.num_tris() == 0) {
+						stats.brick_tris[i] = 0;
+						return;
+					}
+					// The extraction blocks make their own copies of the vertices on the
+					// edges between them, weld these by the edge they're on
+					const mesh_brick &brick = builders.local().build(extracted.num_tris(),
+						[&](const size_t t, const size_t v) {
+							return vertex_edges[extracted.indices[3 * t + v]];
+						},
+						[&](const size_t t, const size_t v) {
+							return extracted.verts[extracted.indices[3 * t + v]];
+						},
+						weld_epsilon);
+					num_verts += brick.verts.size();
+					output_brick(i, brick);
+				});
+		});
+		stats.num_verts = num_verts;
+		stats.num_tris = num_tris;
+		return finish_output() ? 0 : 1;
 	}
-	// Seek back and update the header
-	if (write_binary) {
-		fout.seekp(0);
-		fout.write(reinterpret_cast<const char*>(&n_verts_written), sizeof(uint64_t));
-		fout.write(reinterpret_cast<char*>(&n_indices_written), sizeof(uint64_t));
+	if (adaptive) {
+		brick_writer sizer;
+		sizer.bobj_v2 = bobj_v2;
+		sizer.quant_bits = quant_bits;
+		sizer.compress = compress;
+		sizer.ownership = ownership;
+		adaptive_opts.estimate_size = [&](const uint64_t num_verts, const uint64_t num_tris) {
+			return sizer.estimated_size(num_verts, num_tris, write_binary);
+		};
+		std::vector<adaptive_brick> bricks;
+		stats.time("partition", [&]() {
+			bricks = adaptive_partition(grid, mesh, adaptive_opts, &stats.sat);
+		});
+		std::cout << "Split into " << bricks.size() << " bricks\n";
+		stats.brick_tris.assign(bricks.size(), gridder_stats::NOT_WRITTEN);
+		brick_owned.assign(bricks.size(), 0);
+		brick_bounds = [&](const size_t i) { return bricks[i].bounds; };
+		if (packed && !open_pack(bricks.size())) {
+			return 1;
+		}
+
+		tbb::enumerable_thread_specific<brick_builder> builders;
+		stats.time("output", [&]() {
+			tbb::parallel_for(size_t(0), bricks.size(), size_t(1),
+				[&](const size_t i) {
+					centroid_owner owner;
+					if (ownership) {
+						owner = [&, i](const vec3f &c) { return bricks[i].owns(grid, c); };
+					}
+					output_brick(i, builders.local().build(mesh, bricks[i].tris, weld_epsilon, owner));
+				});
+		});
+
+		return finish_output() ? 0 : 1;
+	}
+	if (packed && !open_pack(ncells)) {
+		return 1;
+	}
+
+	if (out_of_core) {
+		ooc_options.weld_epsilon = weld_epsilon;
+		ooc_options.ownership = ownership;
+		ooc_options.ghost_width = ghost_width;
+		try {
+			stats.time("out_of_core", [&]() {
+				grid_out_of_core(mesh, grid, ooc_options, output_brick, &stats.sat);
+			});
+		} catch (const std::runtime_error &e) {
+			std::cout << "Error: " << e.what() << std::endl;
+			return 1;
+		}
+		return finish_output() ? 0 : 1;
+	}
+
+	std::vector<std::vector<size_t>> cell_tris;
+	if (worker) {
+		// Bin this worker's slice of the triangles, then swap them with the other
+		// workers to get all the triangles for the cells we own
+		size_t tris_begin = 0;
+		size_t tris_end = 0;
+		worker->slice(mesh.num_tris, tris_begin, tris_end);
+		const mesh_view slice = mesh.triangles(tris_begin, tris_end - tris_begin);
+		stats.time("binning", [&]() {
+			cell_tris = bin_triangles(grid, slice, &stats.sat, ghost_width);
+			for (auto &tris : cell_tris) {
+				for (auto &t : tris) {
+					t += tris_begin;
+				}
+			}
+		});
+		stats.time("exchange", [&]() {
+			cell_tris = worker->exchange_triangles(cell_tris);
+		});
+	} else {
+		stats.time("binning", [&]() {
+			cell_tris = bin_triangles(grid, mesh, &stats.sat, ghost_width);
+		});
 	}
-}
 
+	tbb::enumerable_thread_specific<brick_builder> builders;
+	stats.time("output", [&]() {
+		tbb::parallel_for(size_t(0), ncells, size_t(1),
+			[&](const size_t i) {
+				if (worker && !worker->owns_cell(i)) {
+					return;
+				}
+				if (cell_tris[i].empty()) {
+					stats.brick_tris[i] = 0;
+					return;
+				}
+				centroid_owner owner;
+				if (ownership) {
+					owner = [&, i](const vec3f &c) { return grid.cell_containing(c) == i; };
+				}
+				output_brick(i, builders.local().build(mesh, cell_tris[i], weld_epsilon, owner));
+			});
+	});
+	return finish_output() ? 0 : 1;
+}
@@ -0,0 +1,419 @@
+#include <algorithm>
+#include <limits>
+#include <regex>
+#include "tbb/tbb.h"
+#include "isosurface.h"
+
+// Number of cell rows and z layers extracted by each task
+const size_t ISOSURFACE_BLOCK_ROWS = 64;
+const size_t ISOSURFACE_BLOCK_LAYERS = 8;
+
+const uint64_t NO_EDGE_VERTEX = std::numeric_limits<uint64_t>::max();
+
+// Most triangles a cell's surface can have
+const size_t MAX_CELL_TRIS = 5;
+
+// Corner i of a cell is the voxel offset by (i & 1, (i >> 1) & 1, (i >> 2) & 1) from
+// the cell's lower corner, and bit i of a cell's case is set if that corner is above
+// the isovalue. Edge e of a cell runs along axis e / 4 from corner edge_corner[e].
+// The triangles of each case are built from the loops the surface makes through
+// the cell's faces instead of the usual hand written table
+struct marching_cubes_tables {
+	std::array<uint8_t, 12> edge_corner;
+	// Bit f is set if the edge is on face f
+	std::array<uint8_t, 12> edge_faces;
+	std::array<uint8_t, 256> num_tris;
+	// The edges each triangle's vertices lie on
+	std::array<std::array<uint8_t, 3 * MAX_CELL_TRIS>, 256> tris;
+
+	marching_cubes_tables() {
+		for (uint8_t e = 0; e < 12; ++e) {
+			const int axis = e / 4;
+			edge_corner[e] = ((e & 1) << (axis + 1) % 3) | (((e >> 1) & 1) << (axis + 2) % 3);
+		}
+		// The corners of each face, counter clockwise seen from outside the cell
+		std::array<std::array<uint8_t, 4>, 6> faces;
+		for (int axis = 0; axis < 3; ++axis) {
+			const uint8_t u = 1 << (axis + 1) % 3;
+			const uint8_t v = 1 << (axis + 2) % 3;
+			const uint8_t upper = 1 << axis;
+			faces[2 * axis] = {0, v, uint8_t(u | v), u};
+			faces[2 * axis + 1] = {upper, uint8_t(upper | u), uint8_t(upper | u | v), uint8_t(upper | v)};
+		}
+		edge_faces.fill(0);
+		for (size_t f = 0; f < faces.size(); ++f) {
+			for (size_t i = 0; i < 4; ++i) {
+				edge_faces[edge_between(faces[f][i], faces[f][(i + 1) % 4])] |= 1 << f;
+			}
+		}
+
+		for (size_t c = 0; c < 256; ++c) {
+			auto above = [&](const uint8_t corner) { return (c >> corner) & 1; };
+			// Walking around each face the surface enters it on the edge leaving a corner
+			// below the isovalue and exits on the first edge after that leaving a corner above
+			// it. Pairing the crossings this way separates the corners above the isovalue on
+			// ambiguous faces, and the cells sharing the face see the same pairing
+			std::array<int, 12> next;
+			next.fill(-1);
+			for (const auto &f : faces) {
+				for (size_t i = 0; i < 4; ++i) {
+					if (above(f[i]) || !above(f[(i + 1) % 4])) {
+						continue;
+					}
+					size_t j = (i + 1) % 4;
+					while (!above(f[j]) || above(f[(j + 1) % 4])) {
+						j = (j + 1) % 4;
+					}
+					next[edge_between(f[i], f[(i + 1) % 4])] = edge_between(f[j], f[(j + 1) % 4]);
+				}
+			}
+			// Follow each loop of crossed edges and triangulate it
+			num_tris[c] = 0;
+			std::array<bool, 12> visited;
+			visited.fill(false);
+			for (uint8_t e = 0; e < 12; ++e) {
+				if (next[e] < 0 || visited[e]) {
+					continue;
+				}
+				std::array<uint8_t, 12> loop;
+				size_t loop_len = 0;
+				for (int l = e; !visited[l]; l = next[l]) {
+					visited[l] = true;
+					loop[loop_len++] = l;
+				}
+				if (!triangulate_loop(loop, loop_len, 0, loop_len - 1, tris[c], num_tris[c])) {
+					throw std::runtime_error("Failed to triangulate marching cubes case");
+				}
+			}
+		}
+	}
+
+	uint8_t edge_between(const uint8_t a, const uint8_t b) const {
+		const uint8_t lower = std::min(a, b);
+		for (uint8_t e = 0; e < 12; ++e) {
+			if (edge_corner[e] == lower && (a ^ b) == 1 << e / 4) {
+				return e;
+			}
+		}
+		throw std::runtime_error("Corners don't share an edge");
+	}
+
+	// Triangulate the part of the loop from vertex i to j. A diagonal joining two edges
+	// on the same face would lie in the face, where the neighboring cell can triangulate
+	// differently, so only diagonals through the inside of the cell are used
+	bool triangulate_loop(const std::array<uint8_t, 12> &loop, const size_t n, const size_t i,
+			const size_t j, std::array<uint8_t, 3 * MAX_CELL_TRIS> &out, uint8_t &count) const
+	{
+		if (j - i < 2) {
+			return true;
+		}
+		auto valid_side = [&](const size_t a, const size_t b) {
+			return b - a == 1 || (a == 0 && b == n - 1) || !(edge_faces[loop[a]] & edge_faces[loop[b]]);
+		};
+		for (size_t k = i + 1; k < j; ++k) {
+			if (!valid_side(i, k) || !valid_side(k, j) || count >= MAX_CELL_TRIS) {
+				continue;
+			}
+			const uint8_t prev_count = count;
+			// Triangles wind against the loop so they face the corners above the isovalue
+			out[3 * count] = loop[i];
+			out[3 * count + 1] = loop[j];
+			out[3 * count + 2] = loop[k];
+			++count;
+			if (triangulate_loop(loop, n, i, k, out, count) && triangulate_loop(loop, n, k, j, out, count)) {
+				return true;
+			}
+			count = prev_count;
+		}
+		return false;
+	}
+};
+
+// The per thread buffers used to extract a block. Cell corners above the isovalue
+// are flagged for the block's rows of the two voxel slices bounding the current
+// layer of cells, and the vertices on the edges of the current layer are cached
+// so the cells sharing an edge share its vertex
+struct isosurface_scratch {
+	std::array<std::vector<uint8_t>, 2> above;
+	std::vector<uint8_t> cases;
+	std::array<std::vector<uint64_t>, 2> x_edges;
+	std::array<std::vector<uint64_t>, 2> y_edges;
+	std::vector<uint64_t> z_edges;
+};
+
+// Flag the voxels above the isovalue, written without branches so it vectorizes
+template<typename T>
+void classify_voxels(const T *voxels, const size_t n, const float isovalue, uint8_t *above) {
+	for (size_t i = 0; i < n; ++i) {
+		above[i] = static_cast<float>(voxels[i]) >= isovalue;
+	}
+}
+
+// The triangles extracted from a block and the edge id of each of their vertices
+struct isosurface_block {
+	mesh_brick mesh;
+	std::vector<uint64_t> vertex_edges;
+};
+
+// Extract the isosurface at isovalue number isovalue_id of the cells [begin, end) of the volume
+template<typename T>
+void extract_block(const volume_view &volume, const std::vector<float> &isovalues, const size_t isovalue_id,
+		const std::array<size_t, 3> &begin, const std::array<size_t, 3> &end, isosurface_scratch &scratch,
+		isosurface_block &block)
+{
+	static const marching_cubes_tables tables;
+	const T *voxels = reinterpret_cast<const T*>(volume.data);
+	const float isovalue = isovalues[isovalue_id];
+	const size_t nx = volume.dims[0];
+	const size_t ny = volume.dims[1];
+	auto vertex_edge = [&](const size_t x, const size_t y, const size_t z, const size_t kind) {
+		const uint64_t voxel = ((volume.origin[2] + z) * ny + y) * nx + x;
+		return (4 * voxel + kind) * isovalues.size() + isovalue_id;
+	};
+	mesh_brick &mesh = block.mesh;
+	// The block's voxels in each row and rows in each slice
+	const size_t ncols = end[0] - begin[0] + 1;
+	const size_t nrows = end[1] - begin[1] + 1;
+	const size_t slice_voxels = nrows * ncols;
+	auto classify_slice = [&](const size_t z, uint8_t *above) {
+		for (size_t r = 0; r < nrows; ++r) {
+			classify_voxels(voxels + ((z * ny + begin[1] + r) * nx + begin[0]), ncols, isovalue,
+					above + r * ncols);
+		}
+	};
+
+	for (size_t i = 0; i < 2; ++i) {
+		scratch.above[i].resize(slice_voxels);
+		scratch.x_edges[i].resize(slice_voxels);
+		scratch.y_edges[i].resize(slice_voxels);
+	}
+	scratch.z_edges.resize(slice_voxels);
+	scratch.cases.resize(ncols - 1);
+
+	classify_slice(begin[2], scratch.above[0].data());
+	std::fill(scratch.x_edges[0].begin(), scratch.x_edges[0].end(), NO_EDGE_VERTEX);
+	std::fill(scratch.y_edges[0].begin(), scratch.y_edges[0].end(), NO_EDGE_VERTEX);
+	for (size_t z = begin[2]; z < end[2]; ++z) {
+		classify_slice(z + 1, scratch.above[1].data());
+		std::fill(scratch.x_edges[1].begin(), scratch.x_edges[1].end(), NO_EDGE_VERTEX);
+		std::fill(scratch.y_edges[1].begin(), scratch.y_edges[1].end(), NO_EDGE_VERTEX);
+		std::fill(scratch.z_edges.begin(), scratch.z_edges.end(), NO_EDGE_VERTEX);
+
+		for (size_t r = 0; r + 1 < nrows; ++r) {
+			const uint8_t *a00 = &scratch.above[0][r * ncols];
+			const uint8_t *a10 = &scratch.above[0][(r + 1) * ncols];
+			const uint8_t *a01 = &scratch.above[1][r * ncols];
+			const uint8_t *a11 = &scratch.above[1][(r + 1) * ncols];
+			uint8_t *cases = scratch.cases.data();
+			for (size_t c = 0; c + 1 < ncols; ++c) {
+				cases[c] = a00[c] | a00[c + 1] << 1 | a10[c] << 2 | a10[c + 1] << 3
+					| a01[c] << 4 | a01[c + 1] << 5 | a11[c] << 6 | a11[c + 1] << 7;
+			}
+
+			for (size_t c = 0; c + 1 < ncols; ++c) {
+				const uint8_t cell_case = cases[c];
+				if (cell_case == 0 || cell_case == 255) {
+					continue;
+				}
+				auto edge_vertex = [&](const uint8_t e) {
+					const int axis = e / 4;
+					const uint8_t corner = tables.edge_corner[e];
+					const size_t dz = (corner >> 2) & 1;
+					const size_t slot = (r + ((corner >> 1) & 1)) * ncols + c + (corner & 1);
+					uint64_t &id = axis == 0 ? scratch.x_edges[dz][slot]
+						: axis == 1 ? scratch.y_edges[dz][slot] : scratch.z_edges[slot];
+					if (id == NO_EDGE_VERTEX) {
+						const size_t x = begin[0] + c + (corner & 1);
+						const size_t y = begin[1] + r + ((corner >> 1) & 1);
+						const size_t lower = ((z + dz) * ny + y) * nx + x;
+						const size_t stride = axis == 0 ? 1 : axis == 1 ? nx : nx * ny;
+						const float v0 = static_cast<float>(voxels[lower]);
+						const float v1 = static_cast<float>(voxels[lower + stride]);
+						const float t = (isovalue - v0) / (v1 - v0);
+						vec3f p(volume.origin[0] + x, volume.origin[1] + y, volume.origin[2] + z + dz);
+						p[axis] += t;
+						id = mesh.verts.size();
+						mesh.verts.push_back(p);
+						// Vertices landing exactly on a voxel are identified by the voxel, since
+						// every edge touching it can put a vertex there
+						if (t == 0.f || t == 1.f) {
+							const size_t upper = t == 1.f ? 1 : 0;
+							block.vertex_edges.push_back(vertex_edge(x + (axis == 0) * upper,
+									y + (axis == 1) * upper, z + dz + (axis == 2) * upper, 3));
+						} else {
+							block.vertex_edges.push_back(vertex_edge(x, y, z + dz, axis));
+						}
+					}
+					return id;
+				};
+				const uint8_t *tri_edges = tables.tris[cell_case].data();
+				for (size_t i = 0; i < tables.num_tris[cell_case]; ++i) {
+					const std::array<uint64_t, 3> tri = {edge_vertex(tri_edges[3 * i]),
+						edge_vertex(tri_edges[3 * i + 1]), edge_vertex(tri_edges[3 * i + 2])};
+					// Triangles with two vertices on the same voxel collapse to zero area
+					const vec3f &a = mesh.verts[tri[0]];
+					const vec3f n = cross(mesh.verts[tri[1]] - a, mesh.verts[tri[2]] - a);
+					if (dot(n, n) == 0.f) {
+						continue;
+					}
+					mesh.indices.insert(mesh.indices.end(), tri.begin(), tri.end());
+				}
+			}
+		}
+		std::swap(scratch.above[0], scratch.above[1]);
+		std::swap(scratch.x_edges[0], scratch.x_edges[1]);
+		std::swap(scratch.y_edges[0], scratch.y_edges[1]);
+	}
+}
+
+size_t voxel_size(const voxel_type type) {
+	switch (type) {
+		case voxel_type::UINT8:
+		case voxel_type::INT8: return 1;
+		case voxel_type::UINT16:
+		case voxel_type::INT16: return 2;
+		case voxel_type::FLOAT32: return 4;
+		case voxel_type::FLOAT64: return 8;
+		default: break;
+	}
+	throw std::runtime_error("Invalid voxel type");
+}
+
+size_t raw_volume_info::num_voxels() const {
+	return dims[0] * dims[1] * dims[2];
+}
+
+raw_volume_info parse_raw_volume_name(const std::string &fname) {
+	const std::regex match_filename("(\\w+)_(\\d+)x(\\d+)x(\\d+)_(.+)\\.raw");
+	auto matches = std::sregex_iterator(fname.begin(), fname.end(), match_filename);
+	if (matches == std::sregex_iterator() || matches->size() != 6) {
+		throw std::runtime_error("Unrecognized raw volume naming scheme, expected a format like: "
+				"'<name>_<X>x<Y>x<Z>_<data type>.raw' but '" + fname + "' did not match");
+	}
+
+	raw_volume_info info;
+	info.dims = {std::stoul((*matches)[2]), std::stoul((*matches)[3]), std::stoul((*matches)[4])};
+	const std::string data_type = (*matches)[5];
+	if (data_type == "uint8") {
+		info.type = voxel_type::UINT8;
+	} else if (data_type == "int8") {
+		info.type = voxel_type::INT8;
+	} else if (data_type == "uint16") {
+		info.type = voxel_type::UINT16;
+	} else if (data_type == "int16") {
+		info.type = voxel_type::INT16;
+	} else if (data_type == "float32" || data_type == "float") {
+		info.type = voxel_type::FLOAT32;
+	} else if (data_type == "float64" || data_type == "double") {
+		info.type = voxel_type::FLOAT64;
+	} else {
+		throw std::runtime_error("Unsupported or unrecognized data type: " + data_type);
+	}
+	return info;
+}
+
+volume_grid::volume_grid(const std::array<size_t, 3> &volume_dims, const vec3sz &dims)
+	: volume_dims(volume_dims), dims{dims.x, dims.y, dims.z}
+{}
+size_t volume_grid::num_bricks() const {
+	return dims[0] * dims[1] * dims[2];
+}
+void volume_grid::brick_cells(const size_t i, std::array<size_t, 3> &begin, std::array<size_t, 3> &end) const {
+	const std::array<size_t, 3> idx{i % dims[0], (i / dims[0]) % dims[1], i / (dims[0] * dims[1])};
+	for (size_t j = 0; j < 3; ++j) {
+		const size_t ncells = volume_dims[j] > 0 ? volume_dims[j] - 1 : 0;
+		begin[j] = idx[j] * ncells / dims[j];
+		end[j] = (idx[j] + 1) * ncells / dims[j];
+	}
+}
+box3f volume_grid::brick_bounds(const size_t i) const {
+	std::array<size_t, 3> begin, end;
+	brick_cells(i, begin, end);
+	return box3f(vec3f(begin[0], begin[1], begin[2]), vec3f(end[0], end[1], end[2]));
+}
+
+template<typename T>
+void extract_isosurface(const volume_view &volume, const std::array<size_t, 3> &cells_begin,
+		const std::array<size_t, 3> &cells_end, const std::vector<float> &isovalues, mesh_brick &mesh,
+		std::vector<uint64_t> *vertex_edges)
+{
+	for (size_t i = 0; i < 3; ++i) {
+		if (cells_end[i] <= cells_begin[i] || cells_end[i] >= volume.dims[i]) {
+			return;
+		}
+	}
+	const size_t row_blocks = (cells_end[1] - cells_begin[1] + ISOSURFACE_BLOCK_ROWS - 1) / ISOSURFACE_BLOCK_ROWS;
+	const size_t layer_blocks = (cells_end[2] - cells_begin[2] + ISOSURFACE_BLOCK_LAYERS - 1)
+		/ ISOSURFACE_BLOCK_LAYERS;
+	const size_t volume_blocks = row_blocks * layer_blocks;
+	std::vector<isosurface_block> blocks(isovalues.size() * volume_blocks);
+	tbb::enumerable_thread_specific<isosurface_scratch> scratch;
+	tbb::parallel_for(size_t(0), blocks.size(), [&](const size_t b) {
+		const size_t y = cells_begin[1] + (b % volume_blocks) % row_blocks * ISOSURFACE_BLOCK_ROWS;
+		const size_t z = cells_begin[2] + (b % volume_blocks) / row_blocks * ISOSURFACE_BLOCK_LAYERS;
+		const std::array<size_t, 3> begin{cells_begin[0], y, z};
+		const std::array<size_t, 3> end{cells_end[0], std::min(y + ISOSURFACE_BLOCK_ROWS, cells_end[1]),
+			std::min(z + ISOSURFACE_BLOCK_LAYERS, cells_end[2])};
+		extract_block<T>(volume, isovalues, b / volume_blocks, begin, end, scratch.local(), blocks[b]);
+	});
+
+	// Append the blocks' triangles in order, offsetting their vertex indices
+	std::vector<size_t> vert_offsets(blocks.size() + 1, mesh.verts.size());
+	std::vector<size_t> index_offsets(blocks.size() + 1, mesh.indices.size());
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		vert_offsets[b + 1] = vert_offsets[b] + blocks[b].mesh.verts.size();
+		index_offsets[b + 1] = index_offsets[b] + blocks[b].mesh.indices.size();
+	}
+	mesh.verts.resize(vert_offsets.back());
+	mesh.indices.resize(index_offsets.back());
+	if (vertex_edges) {
+		vertex_edges->resize(vert_offsets.back());
+	}
+	tbb::parallel_for(size_t(0), blocks.size(), [&](const size_t b) {
+		const mesh_brick &block = blocks[b].mesh;
+		std::copy(block.verts.begin(), block.verts.end(), mesh.verts.begin() + vert_offsets[b]);
+		std::transform(block.indices.begin(), block.indices.end(), mesh.indices.begin() + index_offsets[b],
+				[&](const uint64_t v) { return v + vert_offsets[b]; });
+		if (vertex_edges) {
+			std::copy(blocks[b].vertex_edges.begin(), blocks[b].vertex_edges.end(),
+					vertex_edges->begin() + vert_offsets[b]);
+		}
+		blocks[b] = isosurface_block();
+	});
+}
+
+void extract_isosurface(const volume_view &volume, const std::vector<float> &isovalues,
+		mesh_brick &mesh, std::vector<uint64_t> *vertex_edges)
+{
+	const std::array<size_t, 3> cells_end{volume.dims[0] - 1, volume.dims[1] - 1, volume.dims[2] - 1};
+	extract_isosurface(volume, {0, 0, 0}, cells_end, isovalues, mesh, vertex_edges);
+}
+
+void extract_isosurface(const volume_view &volume, const std::array<size_t, 3> &cells_begin,
+		const std::array<size_t, 3> &cells_end, const std::vector<float> &isovalues, mesh_brick &mesh,
+		std::vector<uint64_t> *vertex_edges)
+{
+	switch (volume.type) {
+		case voxel_type::UINT8:
+			extract_isosurface<uint8_t>(volume, cells_begin, cells_end, isovalues, mesh, vertex_edges);
+			break;
+		case voxel_type::INT8:
+			extract_isosurface<int8_t>(volume, cells_begin, cells_end, isovalues, mesh, vertex_edges);
+			break;
+		case voxel_type::UINT16:
+			extract_isosurface<uint16_t>(volume, cells_begin, cells_end, isovalues, mesh, vertex_edges);
+			break;
+		case voxel_type::INT16:
+			extract_isosurface<int16_t>(volume, cells_begin, cells_end, isovalues, mesh, vertex_edges);
+			break;
+		case voxel_type::FLOAT32:
+			extract_isosurface<float>(volume, cells_begin, cells_end, isovalues, mesh, vertex_edges);
+			break;
+		case voxel_type::FLOAT64:
+			extract_isosurface<double>(volume, cells_begin, cells_end, isovalues, mesh, vertex_edges);
+			break;
+		default:
+			throw std::runtime_error("Invalid voxel type");
+	}
+	mesh.num_owned = mesh.num_tris();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+#include "brick.h"
+
+// The scalar types a raw volume can store
+enum class voxel_type {
+	UINT8,
+	INT8,
+	UINT16,
+	INT16,
+	FLOAT32,
+	FLOAT64
+};
+
+size_t voxel_size(const voxel_type type);
+
+// The dimensions and voxel type of a raw volume
+struct raw_volume_info {
+	std::array<size_t, 3> dims;
+	voxel_type type;
+
+	size_t num_voxels() const;
+};
+
+// Parse the dimensions and voxel type from a raw volume's file name, which should
+// look like <name>_<X>x<Y>x<Z>_<data type>.raw. Throws a std::runtime_error if the
+// name doesn't match or the data type isn't supported
+raw_volume_info parse_raw_volume_name(const std::string &fname);
+
+// A block of a raw volume's voxels, stored with x varying fastest then y then z. The
+// first voxel of the block is the voxel at origin in the full volume
+struct volume_view {
+	const char *data = nullptr;
+	voxel_type type = voxel_type::UINT8;
+	std::array<size_t, 3> dims{0, 0, 0};
+	std::array<size_t, 3> origin{0, 0, 0};
+};
+
+// Extract the isosurface of the view's cells at each of the isovalues with marching cubes,
+// appending the triangles to the mesh. The cells are processed in parallel in blocks of
+// rows and z layers, and the vertices are placed in the voxel coordinates of the full volume.
+// Ambiguous cell faces always separate the corners above the isovalue, so the surface has
+// no holes. Triangles with zero area, such as those with two vertices landing on the same
+// voxel, are dropped, which can leave vertices no triangle uses. Vertices are shared by the triangles of a block through the cell edge they lie
+// on. Vertices of different blocks on the same edge are separate, but if vertex_edges is
+// given the id of the volume edge each vertex was made on is appended to it, so they can
+// be welded by id instead of by position. Each edge and isovalue has its own id, except
+// that vertices landing exactly on a voxel all get the voxel's id. The ids are unique
+// across views which are z slabs of the same volume.
+void extract_isosurface(const volume_view &volume, const std::vector<float> &isovalues,
+		mesh_brick &mesh, std::vector<uint64_t> *vertex_edges = nullptr);
+
+// Extract the isosurface of the view's cells [cells_begin, cells_end) at each of the
+// isovalues, as above. Cell (x, y, z) spans the voxels from (x, y, z) to (x + 1, y + 1, z + 1)
+// of the view
+void extract_isosurface(const volume_view &volume, const std::array<size_t, 3> &cells_begin,
+		const std::array<size_t, 3> &cells_end, const std::vector<float> &isovalues, mesh_brick &mesh,
+		std::vector<uint64_t> *vertex_edges = nullptr);
+
+// Splits the cells of a volume into a grid of bricks, numbered like the cells of a
+// uniform_grid. Neighboring bricks share the layer of voxels on the face between them,
+// so each cell, and each triangle of the isosurface, is in exactly one brick
+struct volume_grid {
+	std::array<size_t, 3> volume_dims;
+	std::array<size_t, 3> dims;
+
+	volume_grid(const std::array<size_t, 3> &volume_dims, const vec3sz &dims);
+	size_t num_bricks() const;
+	// Get the cells [begin, end) of the brick
+	void brick_cells(const size_t i, std::array<size_t, 3> &begin, std::array<size_t, 3> &end) const;
+	// The bounds of the brick's voxels, in voxel coordinates
+	box3f brick_bounds(const size_t i) const;
+};
+
@@ -1,150 +1,126 @@
 #include <iostream>
-#include <map>
-#include <unordered_map>
+#include <algorithm>
+#include <memory>
 #include <array>
+#include <utility>
 #include <vector>
-#include <fstream>
-#include <regex>
-
-#include <vtkSmartPointer.h>
-#include <vtkTriangle.h>
-#include <vtkFlyingEdges3D.h>
-#include <vtkImageData.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "tbb/tbb.h"
 
 #include "math.h"
+#include "file_io.h"
+#include "isosurface.h"
+#include "slab_writer.h"
+
+// Target size of the voxels read for each slab when -slab isn't given
+const size_t DEFAULT_SLAB_BYTES = size_t(256) * 1024 * 1024;
 
 int main(int argc, char **argv) {
+	if (argc < 5) {
+		std::cout << "Usage: " << argv[0] << " <volume.raw> <output.obj|output.bobj|nooutput>"
+			<< " <num isovalues> <isovalues...> [-slab <layers>]\n"
+			<< "The volume should be named <name>_<X>x<Y>x<Z>_<data type>.raw. It's read and\n"
+			<< "extracted a slab of <layers> z layers of cells at a time, by default slabs\n"
+			<< "are about " << DEFAULT_SLAB_BYTES / (1024 * 1024) << "MB of voxels.\n";
+		return 1;
+	}
 	const int nisosurfaces = std::atoi(argv[3]);
 	const std::string outputfile = argv[2];
 	const std::string file = argv[1];
-	const std::regex match_filename("(\\w+)_(\\d+)x(\\d+)x(\\d+)_(.+)\\.raw");
-	auto matches = std::sregex_iterator(file.begin(), file.end(), match_filename);
-	if (matches == std::sregex_iterator() || matches->size() != 6) {
-		std::cerr << "Unrecognized raw volume naming scheme, expected a format like: "
-			<< "'<name>_<X>x<Y>x<Z>_<data type>.raw' but '" << file << "' did not match"
-			<< std::endl;
-		throw std::runtime_error("Invalaid raw file naming scheme");
-	}
-
-	std::array<int, 3> dims{std::stoi((*matches)[2]),
-		std::stoi((*matches)[3]),
-		std::stoi((*matches)[4])};
-
-	std::string data_type = (*matches)[5];
-
-	size_t dtype_size = 0;
-	int vtk_data_type = -1;
-	if (data_type == "uint8") {
-		dtype_size = 1;
-		vtk_data_type = VTK_UNSIGNED_CHAR;
-	} else if (data_type == "int8") {
-		dtype_size = 1;
-		vtk_data_type = VTK_CHAR;
-	} else if (data_type == "uint16") {
-		dtype_size = 2;
-		vtk_data_type = VTK_UNSIGNED_SHORT;
-	} else if (data_type == "int16") {
-		dtype_size = 2;
-		vtk_data_type = VTK_SHORT;
-	} else if (data_type == "float32" || data_type == "float") {
-		dtype_size = 4;
-		vtk_data_type = VTK_FLOAT;
-	} else if (data_type == "float64" || data_type == "double") {
-		dtype_size = 8;
-		vtk_data_type = VTK_DOUBLE;
-	} else {
-		throw std::runtime_error("Unsupported or unrecognized data type: " + data_type);
-	}
-
-	std::vector<char> volume_data(dtype_size * dims[0] * dims[1] * dims[2], 0);
-	{
-		std::ifstream fin(file.c_str(), std::ios::binary);
-		fin.read(volume_data.data(), volume_data.size());
+	if (nisosurfaces <= 0 || argc < 4 + nisosurfaces) {
+		std::cout << "Error: expected " << argv[3] << " isovalues\n";
+		return 1;
 	}
-	
-	vtkSmartPointer<vtkImageData> img_data = vtkSmartPointer<vtkImageData>::New();
-	img_data->SetDimensions(dims[0], dims[1], dims[2]);
-	img_data->AllocateScalars(vtk_data_type, 1);
-	std::memcpy(img_data->GetScalarPointer(), volume_data.data(), volume_data.size());
-
-	vtkSmartPointer<vtkFlyingEdges3D> fedges = vtkSmartPointer<vtkFlyingEdges3D>::New();
-	fedges->SetInputData(img_data);
-	fedges->SetNumberOfContours(nisosurfaces);
+	std::vector<float> isovalues;
 	for (int i = 0; i < nisosurfaces; ++i) {
 		std::cout << "Isoval: " << argv[i + 4] << "\n";
-		fedges->SetValue(i, std::atof(argv[i + 4]));
+		isovalues.push_back(std::atof(argv[i + 4]));
 	}
-	fedges->SetComputeNormals(false);
-	fedges->Update();
-	vtkPolyData *isosurface = fedges->GetOutput();
-	isosurface->PrintSelf(std::cout, vtkIndent());
-
-	if (outputfile != "nooutput") {
-		std::cout << "Saving mesh to " << outputfile << "\n";
-		std::ofstream fout;
-		const bool write_binary = outputfile.substr(outputfile.size() - 4) == "bobj";
-		if (!write_binary) {
-			fout.open(outputfile.c_str());
+	size_t slab_layers = 0;
+	for (int i = 4 + nisosurfaces; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-slab") == 0 && i + 1 < argc) {
+			slab_layers = std::atoll(argv[++i]);
+			if (slab_layers == 0) {
+				std::cout << "Error: -slab requires a positive number of layers\n";
+				return 1;
+			}
 		} else {
-			fout.open(outputfile.c_str(), std::ios::binary);
-			uint64_t header[2] = {0};
-			fout.write(reinterpret_cast<char*>(header), sizeof(header));
+			std::cout << "Error: unrecognized option " << argv[i] << "\n";
+			return 1;
 		}
-		size_t next_vert_id = 1;
-		std::unordered_map<uint64_t, uint64_t> vertex_remapping;
-		std::map<vec3f, uint64_t> remapped_verts;
-
-		for (size_t i = 0; i < isosurface->GetNumberOfCells(); ++i) {
-			vtkTriangle *tri = dynamic_cast<vtkTriangle*>(isosurface->GetCell(i));
-			if (tri->ComputeArea() == 0.0) {
-				continue;
-			}
-			for (size_t v = 0; v < 3; ++v) {
-				const vec3f vert(isosurface->GetPoint(tri->GetPointId(v))[0],
-						isosurface->GetPoint(tri->GetPointId(v))[1],
-						isosurface->GetPoint(tri->GetPointId(v))[2]);
+	}
 
-				if (remapped_verts.find(vert) == remapped_verts.end()) {
-					remapped_verts[vert] = next_vert_id;
+	try {
+		const raw_volume_info info = parse_raw_volume_name(file);
+		input_file volume_file(file);
+		const size_t slice_bytes = info.dims[0] * info.dims[1] * voxel_size(info.type);
+		if (volume_file.size() < slice_bytes * info.dims[2]) {
+			throw std::runtime_error("Raw volume '" + file + "' is smaller than its dimensions");
+		}
+		const size_t num_layers = info.dims[2] > 0 ? info.dims[2] - 1 : 0;
+		if (slab_layers == 0) {
+			slab_layers = std::max(size_t(1), DEFAULT_SLAB_BYTES / std::max(slice_bytes, size_t(1)));
+		}
 
-					if (!write_binary) {
-						fout << "v " << vert.x << " " << vert.y << " " << vert.z << "\n";
-					} else {
-						fout.write(reinterpret_cast<const char*>(&vert), sizeof(vert));
-					}
+		std::unique_ptr<slab_writer> writer;
+		if (outputfile != "nooutput") {
+			std::cout << "Saving mesh to " << outputfile << "\n";
+			writer = std::make_unique<slab_writer>(outputfile);
+		}
 
-					++next_vert_id;
-				}
-				vertex_remapping[tri->GetPointId(v)] = remapped_verts[vert];
-			}
+		// Each slab reads the slice at its top again as the next slab's bottom slice,
+		// and the next slab is read while the current one is extracted
+		std::array<std::vector<char>, 2> slabs;
+		auto read_slab = [&](const size_t z, std::vector<char> &slab) {
+			const size_t nslices = std::min(slab_layers, num_layers - z) + 1;
+			slab.resize(nslices * slice_bytes);
+			volume_file.read(slab.data(), slab.size(), z * slice_bytes);
+		};
+		if (num_layers > 0) {
+			read_slab(0, slabs[0]);
 		}
-		const uint64_t n_verts_written = next_vert_id - 1;
-		uint64_t n_indices_written = 0;
-		for (size_t i = 0; i < isosurface->GetNumberOfCells(); ++i) {
-			std::array<uint64_t, 3> tids;
-			vtkTriangle *tri = dynamic_cast<vtkTriangle*>(isosurface->GetCell(i));
-			if (tri->ComputeArea() == 0.0) {
-				continue;
-			}
-			for (size_t v = 0; v < 3; ++v) {
-				tids[v] = vertex_remapping[tri->GetPointId(v)];
+
+		using namespace std::chrono;
+		auto start = high_resolution_clock::now();
+		size_t num_extracted = 0;
+		mesh_brick isosurface;
+		std::vector<uint64_t> vertex_edges;
+		for (size_t z = 0; z < num_layers; z += slab_layers) {
+			tbb::task_group prefetch;
+			if (z + slab_layers < num_layers) {
+				prefetch.run([&]() { read_slab(z + slab_layers, slabs[1]); });
 			}
-			if (!write_binary) {
-				fout << "f " << tids[0] << " " << tids[1] << " " << tids[2] << "\n";
-			} else {
-				for (uint64_t &x : tids) {
-					x -= 1;
-				}
-				fout.write(reinterpret_cast<char*>(tids.data()), sizeof(uint64_t) * tids.size());
+			volume_view volume;
+			volume.data = slabs[0].data();
+			volume.type = info.type;
+			volume.dims = {info.dims[0], info.dims[1], slabs[0].size() / slice_bytes};
+			volume.origin = {0, 0, z};
+
+			isosurface.clear();
+			vertex_edges.clear();
+			extract_isosurface(volume, isovalues, isosurface, &vertex_edges);
+			num_extracted += isosurface.num_tris();
+			if (writer) {
+				writer->write_slab(isosurface, vertex_edges, z + volume.dims[2] - 1);
 			}
-			++n_indices_written;
+			prefetch.wait();
+			std::swap(slabs[0], slabs[1]);
+		}
+		if (writer) {
+			writer->finish();
 		}
-		// Seek back and update the header
-		if (write_binary) {
-			fout.seekp(0);
-			fout.write(reinterpret_cast<const char*>(&n_verts_written), sizeof(uint64_t));
-			fout.write(reinterpret_cast<char*>(&n_indices_written), sizeof(uint64_t));
+		auto end = high_resolution_clock::now();
+		std::cout << "Extracted " << num_extracted << " triangles in "
+			<< duration_cast<milliseconds>(end - start).count() << "ms\n";
+		if (writer) {
+			std::cout << "Wrote " << writer->n_indices_written << " triangles with "
+				<< writer->n_verts_written << " vertices\n";
 		}
+	} catch (const std::runtime_error &e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		return 1;
 	}
 
 	return 0;
@@ -0,0 +1,20 @@
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "manifest.h"
+
+void write_manifest(const std::string &fname, const std::vector<brick_info> &bricks) {
+	std::ofstream fout(fname.c_str());
+	// Write enough digits that the bounds read back exactly
+	fout.precision(std::numeric_limits<float>::max_digits10);
+	fout << "# id lower.x lower.y lower.z upper.x upper.y upper.z triangles owned\n";
+	for (const auto &b : bricks) {
+		fout << b.id << " " << b.bounds.lower.x << " " << b.bounds.lower.y << " " << b.bounds.lower.z
+			<< " " << b.bounds.upper.x << " " << b.bounds.upper.y << " " << b.bounds.upper.z
+			<< " " << b.num_tris << " " << b.num_owned << "\n";
+	}
+	if (!fout) {
+		throw std::runtime_error("Failed to write manifest " + fname);
+	}
+}
+
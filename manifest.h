@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+
+// The manifest entry of a brick written out by the gridder
+struct brick_info {
+	uint64_t id = 0;
+	box3f bounds;
+	uint64_t num_tris = 0;
+	// The number of the brick's triangles it owns
+	uint64_t num_owned = 0;
+};
+
+// Write the manifest of the bricks as a text file with one line per brick, giving
+// the brick id, the lower and upper corners of its bounds, its triangle count and
+// the number of those triangles it owns.
+// Lines starting with # are comments. Throws a std::runtime_error if the file
+// can't be written.
+void write_manifest(const std::string &fname, const std::vector<brick_info> &bricks);
+
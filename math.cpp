@@ -2,6 +2,9 @@
 #include <iostream>
 #include <stdexcept>
 #include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include "math.h"
 
 box3f::box3f()
@@ -18,6 +21,15 @@ void box3f::extend(const vec3f &v) {
 	upper.y = std::max(upper.y, v.y);
 	upper.z = std::max(upper.z, v.z);
 }
+void box3f::extend(const box3f &b) {
+	lower.x = std::min(lower.x, b.lower.x);
+	lower.y = std::min(lower.y, b.lower.y);
+	lower.z = std::min(lower.z, b.lower.z);
+
+	upper.x = std::max(upper.x, b.upper.x);
+	upper.y = std::max(upper.y, b.upper.y);
+	upper.z = std::max(upper.z, b.upper.z);
+}
 vec3f box3f::center() const {
 	return lerp(0.5, lower, upper);
 }
@@ -38,6 +50,18 @@ std::ostream& operator<<(std::ostream &os, const box3f &b) {
 	return os;
 }
 
+// The scalar and SIMD triangle/box tests must round exactly the same way, or which
+// bricks a triangle lands in would depend on the CPU. Contracting their multiply-adds
+// into FMAs changes the rounding, so it's turned off for them
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+// Check if the projections p0, p1, p2 of the triangle onto an axis are separated
+// from the projection of the box onto the axis, [-r, r]
+inline bool separated(const float p0, const float p1, const float p2, const float r) {
+	return std::min(p0, std::min(p1, p2)) > r || std::max(p0, std::max(p1, p2)) < -r;
+}
+
 bool line_box_intersection(const vec3f &pa, const vec3f &pb, const box3f &box) {
 	const vec3f dir = pb - pa;
 	const vec3f inv_dir = 1.0 / dir;
@@ -78,56 +102,228 @@ bool line_box_intersection(const vec3f &pa, const vec3f &pb, const box3f &box) {
 	return tmin >= 0.0 && tmax <= 1.0;
 }
 
+// Test a triangle which has been translated so the box is centered at the origin
+// against a box with the given half lengths. Returns the SAT bullet (1-3) which
+// separated the triangle from the box, or 0 if they intersect
+int centered_triangle_box_separation(const vec3f &v0, const vec3f &v1, const vec3f &v2,
+		const vec3f &half_lens)
+{
+	// Bullet 1: Check if we can separate the triangle AABB and the box
+	if (separated(v0.x, v1.x, v2.x, half_lens.x)
+			|| separated(v0.y, v1.y, v2.y, half_lens.y)
+			|| separated(v0.z, v1.z, v2.z, half_lens.z))
+	{
+		return 1;
+	}
+
+	// Bullet 2: test for overlap of the triangle plane and AABB
+	const std::array<vec3f, 3> edge{v1 - v0, v2 - v1, v0 - v2};
+	const vec3f tri_normal = cross(edge[0], edge[1]);
+	const vec3f vmin(tri_normal.x > 0.0f ? -half_lens.x - v0.x : half_lens.x - v0.x,
+			tri_normal.y > 0.0f ? -half_lens.y - v0.y : half_lens.y - v0.y,
+			tri_normal.z > 0.0f ? -half_lens.z - v0.z : half_lens.z - v0.z);
+	if (dot(tri_normal, vmin) > 0.0f) {
+		return 2;
+	}
+
+	// Bullet 3: the 9 axes are the cross products of the box axes and triangle edges,
+	// cross(x, e) = (0, -e.z, e.y), cross(y, e) = (e.z, 0, -e.x), cross(z, e) = (-e.y, e.x, 0)
+	for (const auto &e : edge) {
+		if (separated(-e.z * v0.y + e.y * v0.z, -e.z * v1.y + e.y * v1.z, -e.z * v2.y + e.y * v2.z,
+					half_lens.y * std::abs(e.z) + half_lens.z * std::abs(e.y))
+				|| separated(e.z * v0.x + -e.x * v0.z, e.z * v1.x + -e.x * v1.z, e.z * v2.x + -e.x * v2.z,
+					half_lens.x * std::abs(e.z) + half_lens.z * std::abs(e.x))
+				|| separated(-e.y * v0.x + e.x * v0.y, -e.y * v1.x + e.x * v1.y, -e.y * v2.x + e.x * v2.y,
+					half_lens.x * std::abs(e.y) + half_lens.y * std::abs(e.x)))
+		{
+			return 3;
+		}
+	}
+	return 0;
+}
+
 bool triangle_box_intersection(const vec3f &pa, const vec3f &pb, const vec3f &pc, const box3f &box) {
 	// Translate so that the box center is at the origin
 	const vec3f bcenter = box.center();
-	const std::array<vec3f, 3> vert{pa - bcenter, pb - bcenter, pc - bcenter};
-	const std::array<vec3f, 3> edge{vert[1] - vert[0], vert[2] - vert[1], vert[0] - vert[2]};
-	const std::array<vec3f, 3> axes{vec3f(1, 0, 0), vec3f(0, 1, 0), vec3f(0, 0, 1)};
-	const vec3f half_lens = box.half_lengths();
+	return centered_triangle_box_separation(pa - bcenter, pb - bcenter, pc - bcenter,
+			box.half_lengths()) == 0;
+}
 
-	// Bullet 1: Check if we can separate the triangle AABB and the box
-	for (int i = 0; i < 3; ++i) {
-		const float min = std::min(vert[0][i], std::min(vert[1][i], vert[2][i]));
-		const float max = std::max(vert[0][i], std::max(vert[1][i], vert[2][i]));
-		if (min > half_lens[i] || max < -half_lens[i]) {
-			return false;
-		}
+size_t triangle_batch::push_back(const vec3f &pa, const vec3f &pb, const vec3f &pc) {
+	const std::array<const vec3f*, 3> p{&pa, &pb, &pc};
+	for (size_t i = 0; i < 3; ++i) {
+		v[i][0][count] = p[i]->x;
+		v[i][1][count] = p[i]->y;
+		v[i][2][count] = p[i]->z;
 	}
+	return count++;
+}
+bool triangle_batch::full() const {
+	return count == TRIANGLE_BATCH_SIZE;
+}
 
-	// Bullet 2: test for overlap of the triangle plane and AABB
-	const vec3f tri_normal = cross(edge[0], edge[1]);
-	{
-		vec3f vmin, vmax;
-		for (int i = 0; i < 3; ++i) {
-			if (tri_normal[i] > 0.0f) {
-				vmin[i] = -half_lens[i] - vert[0][i];
-				vmax[i] = half_lens[i] - vert[0][i];
-			} else {
-				vmin[i] = half_lens[i] - vert[0][i];
-				vmax[i] = -half_lens[i] - vert[0][i];
-			}
+sat_counters& sat_counters::operator+=(const sat_counters &c) {
+	tested += c.tested;
+	for (size_t i = 0; i < 3; ++i) {
+		rejected[i] += c.rejected[i];
+	}
+	untested += c.untested;
+	return *this;
+}
+
+// The batch kernels return the mask of intersecting lanes. If rejects is passed,
+// rejects[i] is set to the mask of lanes separated by bullets 1 through i + 1
+uint32_t scalar_triangle_box_intersection(const triangle_batch &batch, const box3f &box,
+		uint32_t *rejects)
+{
+	const vec3f bcenter = box.center();
+	const vec3f half_lens = box.half_lengths();
+	uint32_t mask = 0;
+	uint32_t bullet_masks[3] = {0, 0, 0};
+	for (size_t k = 0; k < batch.count; ++k) {
+		std::array<vec3f, 3> vert;
+		for (size_t i = 0; i < 3; ++i) {
+			vert[i] = vec3f(batch.v[i][0][k], batch.v[i][1][k], batch.v[i][2][k]) - bcenter;
 		}
-		if (dot(tri_normal, vmin) > 0.0f) {
-			return false;
+		const int bullet = centered_triangle_box_separation(vert[0], vert[1], vert[2], half_lens);
+		if (bullet == 0) {
+			mask |= 1u << k;
+		} else {
+			bullet_masks[bullet - 1] |= 1u << k;
 		}
 	}
+	if (rejects) {
+		rejects[0] = bullet_masks[0];
+		rejects[1] = rejects[0] | bullet_masks[1];
+		rejects[2] = rejects[1] | bullet_masks[2];
+	}
+	return mask;
+}
 
-	// Bullet 3
-	// This is not the most optimal way to write the 9 tests for bullet 3, but it's easier to read
-	for (int i = 0; i < 3; ++i) {
-		for (int j = 0; j < 3; ++j) {
-			const vec3f a = cross(axes[i], edge[j]);
-			const std::array<float, 3> p = {dot(a, vert[0]), dot(a, vert[1]), dot(a, vert[2])};
-			const float minp = std::min(p[0], std::min(p[1], p[2]));
-			const float maxp = std::max(p[0], std::max(p[1], p[2]));
-			const float r = half_lens.x * std::abs(a.x) + half_lens.y * std::abs(a.y)
-				+ half_lens.z * std::abs(a.z);
-			if (minp > r || maxp < -r) {
-				return false;
-			}
+#if defined(__GNUC__) && defined(__x86_64__)
+// The SIMD kernel in sat_simd.h is written once with GCC vector extensions and
+// compiled for AVX2 and AVX-512. The helpers are always inlined into the target
+// functions, so the vector ABI warnings don't apply.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#include <immintrin.h>
+
+typedef float v8f __attribute__((vector_size(32)));
+typedef int32_t v8i __attribute__((vector_size(32)));
+typedef float v16f __attribute__((vector_size(64)));
+typedef int32_t v16i __attribute__((vector_size(64)));
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+#include "sat_simd.h"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace avx512 {
+#include "sat_simd.h"
+}
+#pragma GCC pop_options
+
+__attribute__((target("avx2")))
+uint32_t avx2_triangle_box_intersection(const triangle_batch &batch, const box3f &box,
+		uint32_t *rejects)
+{
+	const vec3f bcenter = box.center();
+	const vec3f half_lens = box.half_lengths();
+	if (rejects) {
+		std::fill(rejects, rejects + 3, 0);
+	}
+	uint32_t mask = 0;
+	for (size_t offset = 0; offset < batch.count; offset += 8) {
+		mask |= avx2::simd_triangle_box_intersection<v8f, v8i>(batch, offset, bcenter, half_lens, rejects);
+	}
+	return mask;
+}
+
+__attribute__((target("avx512f")))
+uint32_t avx512_triangle_box_intersection(const triangle_batch &batch, const box3f &box,
+		uint32_t *rejects)
+{
+	const vec3f bcenter = box.center();
+	const vec3f half_lens = box.half_lengths();
+	if (rejects) {
+		std::fill(rejects, rejects + 3, 0);
+	}
+	return avx512::simd_triangle_box_intersection<v16f, v16i>(batch, 0, bcenter, half_lens, rejects);
+}
+#pragma GCC diagnostic pop
+#endif
+#pragma GCC pop_options
+
+using batch_intersection_fn = uint32_t (*)(const triangle_batch &, const box3f &, uint32_t *);
+
+bool sat_kernel_supported(const sat_kernel kernel) {
+	switch (kernel) {
+	case sat_kernel::SCALAR:
+		return true;
+#if defined(__GNUC__) && defined(__x86_64__)
+	case sat_kernel::AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+	case sat_kernel::AVX512:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx512f");
+#endif
+	default:
+		return false;
+	}
+}
+
+batch_intersection_fn batch_intersection_kernel(const sat_kernel kernel) {
+	if (!sat_kernel_supported(kernel)) {
+		throw std::runtime_error("The SAT kernel is not supported on this CPU");
+	}
+	switch (kernel) {
+#if defined(__GNUC__) && defined(__x86_64__)
+	case sat_kernel::AVX2:
+		return avx2_triangle_box_intersection;
+	case sat_kernel::AVX512:
+		return avx512_triangle_box_intersection;
+#endif
+	default:
+		return scalar_triangle_box_intersection;
+	}
+}
+
+batch_intersection_fn select_batch_intersection() {
+	for (const sat_kernel k : {sat_kernel::AVX512, sat_kernel::AVX2}) {
+		if (sat_kernel_supported(k)) {
+			return batch_intersection_kernel(k);
 		}
 	}
-	return true;
+	return scalar_triangle_box_intersection;
+}
+
+uint32_t triangle_box_intersection(const triangle_batch &batch, const box3f &box, const sat_kernel kernel) {
+	const uint32_t valid = (1u << batch.count) - 1;
+	return batch_intersection_kernel(kernel)(batch, box, nullptr) & valid;
+}
+
+uint32_t triangle_box_intersection(const triangle_batch &batch, const box3f &box,
+		sat_counters *counters)
+{
+	static const batch_intersection_fn batch_intersection = select_batch_intersection();
+	// Lanes past the end of the batch hold stale data, mask them off
+	const uint32_t valid = (1u << batch.count) - 1;
+	if (!counters) {
+		return batch_intersection(batch, box, nullptr) & valid;
+	}
+	uint32_t rejects[3];
+	const uint32_t mask = batch_intersection(batch, box, rejects) & valid;
+	counters->tested += batch.count;
+	uint32_t prev = 0;
+	for (size_t i = 0; i < 3; ++i) {
+		counters->rejected[i] += __builtin_popcount(rejects[i] & valid & ~prev);
+		prev = rejects[i];
+	}
+	return mask;
 }
 
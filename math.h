@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <ostream>
 #include <array>
+#include <cstdint>
 
 template<typename T>
 T lerp(const float t, const T &a, const T &b) {
@@ -111,6 +112,7 @@ struct box3f {
 	box3f();
 	box3f(const vec3f &lower, const vec3f &upper);
 	void extend(const vec3f &v);
+	void extend(const box3f &b);
 	vec3f center() const;
 	vec3f half_lengths() const;
 	const vec3f& operator[](const size_t i) const;
@@ -125,3 +127,51 @@ bool line_box_intersection(const vec3f &pa, const vec3f &pb, const box3f &box);
 // http://fileadmin.cs.lth.se/cs/Personal/Tomas_Akenine-Moller/code/tribox3.txt
 bool triangle_box_intersection(const vec3f &pa, const vec3f &pb, const vec3f &pc, const box3f &box);
 
+
+// Number of triangles tested together by the batched triangle/box test
+const size_t TRIANGLE_BATCH_SIZE = 16;
+
+// A batch of triangles stored in SoA layout for the batched triangle/box test,
+// v[i][j][k] is component j of vertex i of triangle k in the batch
+struct triangle_batch {
+	alignas(64) float v[3][3][TRIANGLE_BATCH_SIZE] = {};
+	size_t count = 0;
+
+	// Append a triangle to the batch, returns its lane in the batch
+	size_t push_back(const vec3f &pa, const vec3f &pb, const vec3f &pc);
+	bool full() const;
+};
+
+// Counts of the exact triangle/box tests run and the number of triangles
+// rejected at each bullet of the SAT test
+struct sat_counters {
+	uint64_t tested = 0;
+	uint64_t rejected[3] = {};
+	// Candidates which were accepted without running the test
+	uint64_t untested = 0;
+
+	sat_counters& operator+=(const sat_counters &c);
+};
+
+// Test each triangle in the batch against the box using the same SAT method as
+// triangle_box_intersection. Returns a mask with bit i set if triangle i intersects
+// the box. The AVX-512 or AVX2 kernel is used if supported by the CPU, otherwise
+// the triangles are tested one by one. If counters is passed the tests and
+// rejections in the batch are added to it.
+uint32_t triangle_box_intersection(const triangle_batch &batch, const box3f &box,
+		sat_counters *counters = nullptr);
+
+// The kernels the batched triangle/box test can run on
+enum class sat_kernel {
+	SCALAR,
+	AVX2,
+	AVX512
+};
+
+// Check if the kernel was built in and is supported by the CPU
+bool sat_kernel_supported(const sat_kernel kernel);
+
+// Test the batch with a specific kernel, which must be supported. Returns the
+// same mask as the batched test above, so the kernels can be checked against
+// each other
+uint32_t triangle_box_intersection(const triangle_batch &batch, const box3f &box, const sat_kernel kernel);
@@ -0,0 +1,247 @@
+#include <stdexcept>
+#include <cstring>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <sys/mman.h>
+#include "tbb/tbb.h"
+#include "mesh.h"
+#include "bobj.h"
+#include "stream_codec.h"
+
+mesh_view::mesh_view(const std::vector<float> &verts, const std::vector<uint64_t> &indices)
+	: verts(verts.data()), num_verts(verts.size() / 3),
+	index_data(reinterpret_cast<const char*>(indices.data())), num_tris(indices.size() / 3)
+{}
+
+// Number of vertices each task of the bounds reduction processes at least
+const size_t BOUNDS_GRAIN_SIZE = 1 << 16;
+
+box3f packed_bounds(const float *verts, const size_t n) {
+	// Take the min and max of 4 vertices at a time as 12 independent lanes,
+	// which the compiler turns into a few SIMD min/max ops per group
+	const size_t GROUP = 12;
+	float lower[GROUP];
+	float upper[GROUP];
+	std::fill(lower, lower + GROUP, std::numeric_limits<float>::infinity());
+	std::fill(upper, upper + GROUP, -std::numeric_limits<float>::infinity());
+	const size_t ngroups = (3 * n) / GROUP;
+	for (size_t g = 0; g < ngroups; ++g) {
+		const float *v = verts + g * GROUP;
+		for (size_t j = 0; j < GROUP; ++j) {
+			lower[j] = std::min(lower[j], v[j]);
+			upper[j] = std::max(upper[j], v[j]);
+		}
+	}
+	box3f bounds;
+	for (size_t j = 0; j < GROUP; j += 3) {
+		bounds.extend(box3f(vec3f(lower[j], lower[j + 1], lower[j + 2]),
+					vec3f(upper[j], upper[j + 1], upper[j + 2])));
+	}
+	for (size_t i = ngroups * GROUP; i < 3 * n; i += 3) {
+		bounds.extend(vec3f(verts[i], verts[i + 1], verts[i + 2]));
+	}
+	return bounds;
+}
+
+box3f mesh_bounds(const mesh_view &mesh, const size_t begin, const size_t end) {
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(begin, end, BOUNDS_GRAIN_SIZE), box3f(),
+		[&](const tbb::blocked_range<size_t> &r, box3f bounds) {
+			bounds.extend(packed_bounds(mesh.verts + 3 * r.begin(), r.size()));
+			return bounds;
+		},
+		[](box3f a, const box3f &b) {
+			a.extend(b);
+			return a;
+		});
+}
+
+bobj_file::bobj_file(const std::string &fname, const bool in_place) : file(fname) {
+	if (file.size() >= sizeof(BOBJ_MAGIC)
+			&& std::memcmp(file.data(), BOBJ_MAGIC, sizeof(BOBJ_MAGIC)) == 0)
+	{
+		load_v2(fname, in_place);
+	} else {
+		load_v1(fname);
+	}
+}
+void bobj_file::load_v1(const std::string &fname) {
+	uint64_t header[2] = {0};
+	if (file.size() < sizeof(header)) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": missing header");
+	}
+	std::memcpy(header, file.data(), sizeof(header));
+
+	const size_t verts_offset = sizeof(header);
+	const size_t indices_offset = verts_offset + sizeof(float) * 3 * header[0];
+	const size_t file_end = indices_offset + sizeof(uint64_t) * 3 * header[1];
+	if (header[0] > file.size() || header[1] > file.size() || file_end > file.size()) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": file is truncated");
+	}
+
+	mesh.verts = reinterpret_cast<const float*>(file.data() + verts_offset);
+	mesh.num_verts = header[0];
+	mesh.num_tris = header[1];
+	num_owned_tris = mesh.num_tris;
+	// Vertices are gathered randomly through the index buffer so we want them
+	// resident, while the index buffer is streamed through in order
+	file.advise(verts_offset, indices_offset - verts_offset, MADV_WILLNEED);
+	// The index array is only 8 byte aligned when the vertex count is even, the view
+	// reads the indices with unaligned loads so it's mapped either way
+	mesh.index_data = file.data() + indices_offset;
+	file.advise(indices_offset, file_end - indices_offset, MADV_SEQUENTIAL);
+}
+
+template<typename T>
+void widen_indices(const char *in, std::vector<uint64_t> &indices) {
+	const T *narrow = reinterpret_cast<const T*>(in);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, indices.size()),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t i = r.begin(); i != r.end(); ++i) {
+				indices[i] = narrow[i];
+			}
+		});
+}
+
+void bobj_file::load_v2(const std::string &fname, const bool in_place) {
+	bobj_header header;
+	if (file.size() < sizeof(header)) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": missing header");
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (header.version != BOBJ_VERSION) {
+		throw std::runtime_error("Unsupported bobj version " + std::to_string(header.version)
+				+ " in " + fname);
+	}
+	if (header.index_bytes != 2 && header.index_bytes != 4 && header.index_bytes != 8) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": bad index width");
+	}
+	const bool quantized = header.flags & BOBJ_QUANTIZED;
+	if (quantized && (header.quant_bits == 0 || header.quant_bits > BOBJ_MAX_QUANT_BITS)) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": bad quantization bits");
+	}
+	if (header.num_verts > file.size() || header.num_tris > file.size()) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": file is truncated");
+	}
+	if (header.flags & BOBJ_HAS_BOUNDS) {
+		has_bounds = true;
+		bounds = box3f(vec3f(header.lower[0], header.lower[1], header.lower[2]),
+				vec3f(header.upper[0], header.upper[1], header.upper[2]));
+	}
+	num_owned_tris = header.num_tris;
+	if (header.flags & BOBJ_HAS_OWNERSHIP) {
+		if (header.num_owned_tris > header.num_tris) {
+			throw std::runtime_error("Invalid bobj file " + fname + ": more owned triangles than triangles");
+		}
+		num_owned_tris = header.num_owned_tris;
+	}
+	if (in_place && (quantized || (header.flags & BOBJ_COMPRESSED) || header.index_bytes != 8)) {
+		throw std::runtime_error(fname + " can't be read in place, it's quantized, compressed or has"
+				" narrow indices, which are decoded into memory");
+	}
+	if (header.flags & BOBJ_COMPRESSED) {
+		load_compressed(fname, header);
+		return;
+	}
+
+	const size_t verts_offset = sizeof(header);
+	const size_t indices_offset = verts_offset + bobj_verts_bytes(header.num_verts, quantized);
+	const size_t file_end = indices_offset + header.index_bytes * 3 * header.num_tris;
+	if (file_end > file.size()) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": file is truncated");
+	}
+
+	mesh.num_verts = header.num_verts;
+	mesh.num_tris = header.num_tris;
+	if (!quantized) {
+		mesh.verts = reinterpret_cast<const float*>(file.data() + verts_offset);
+		file.advise(verts_offset, indices_offset - verts_offset, MADV_WILLNEED);
+	} else {
+		const vec3f lower(header.lower[0], header.lower[1], header.lower[2]);
+		const vec3f upper(header.upper[0], header.upper[1], header.upper[2]);
+		const vec3f scale = (upper - lower) * (1.f / static_cast<float>((1u << header.quant_bits) - 1));
+		const uint16_t *q = reinterpret_cast<const uint16_t*>(file.data() + verts_offset);
+		decoded_verts.resize(3 * header.num_verts);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, header.num_verts),
+			[&](const tbb::blocked_range<size_t> &r) {
+				for (size_t i = r.begin(); i != r.end(); ++i) {
+					// Clamp to the upper bound, which the rounding of the scale can
+					// overshoot, so the header bounds always contain the vertices
+					decoded_verts[3 * i] = std::min(lower.x + q[3 * i] * scale.x, upper.x);
+					decoded_verts[3 * i + 1] = std::min(lower.y + q[3 * i + 1] * scale.y, upper.y);
+					decoded_verts[3 * i + 2] = std::min(lower.z + q[3 * i + 2] * scale.z, upper.z);
+				}
+			});
+		mesh.verts = decoded_verts.data();
+	}
+
+	const char *indices = file.data() + indices_offset;
+	if (header.index_bytes == 8) {
+		mesh.index_data = indices;
+		file.advise(indices_offset, file_end - indices_offset, MADV_SEQUENTIAL);
+		return;
+	}
+	aligned_indices.resize(3 * header.num_tris);
+	if (header.index_bytes == 4) {
+		widen_indices<uint32_t>(indices, aligned_indices);
+	} else {
+		widen_indices<uint16_t>(indices, aligned_indices);
+	}
+	mesh.index_data = reinterpret_cast<const char*>(aligned_indices.data());
+}
+
+void bobj_file::load_compressed(const std::string &fname, const bobj_header &header) {
+	bobj_streams streams;
+	if (file.size() < sizeof(header) + sizeof(streams)) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": missing stream table");
+	}
+	std::memcpy(&streams, file.data() + sizeof(header), sizeof(streams));
+	std::array<const uint8_t*, 4> stream_data;
+	size_t offset = sizeof(header) + sizeof(streams);
+	for (size_t i = 0; i < 4; ++i) {
+		if (streams.bytes[i] > file.size() - offset) {
+			throw std::runtime_error("Invalid bobj file " + fname + ": file is truncated");
+		}
+		stream_data[i] = reinterpret_cast<const uint8_t*>(file.data() + offset);
+		offset += streams.bytes[i];
+	}
+
+	const bool quantized = header.flags & BOBJ_QUANTIZED;
+	const vec3f lower(header.lower[0], header.lower[1], header.lower[2]);
+	const vec3f upper(header.upper[0], header.upper[1], header.upper[2]);
+	const vec3f scale = quantized ? (upper - lower) * (1.f / static_cast<float>((1u << header.quant_bits) - 1))
+		: vec3f(0.f);
+	decoded_verts.resize(3 * header.num_verts);
+	aligned_indices.resize(3 * header.num_tris);
+
+	// The streams are independent, so decode them in parallel
+	std::atomic<bool> valid(true);
+	tbb::parallel_for(size_t(0), size_t(4), size_t(1),
+		[&](const size_t i) {
+			const size_t n = i < 3 ? header.num_verts : aligned_indices.size();
+			std::vector<uint32_t> values(n);
+			if (!delta_vbyte_decode(stream_data[i], streams.bytes[i], n, values.data())) {
+				valid = false;
+				return;
+			}
+			if (i == 3) {
+				std::copy(values.begin(), values.end(), aligned_indices.begin());
+				return;
+			}
+			for (size_t v = 0; v < n; ++v) {
+				if (quantized) {
+					decoded_verts[3 * v + i] = std::min(lower[i] + values[v] * scale[i], upper[i]);
+				} else {
+					std::memcpy(&decoded_verts[3 * v + i], &values[v], sizeof(float));
+				}
+			}
+		});
+	if (!valid) {
+		throw std::runtime_error("Invalid bobj file " + fname + ": compressed stream is truncated");
+	}
+	mesh.verts = decoded_verts.data();
+	mesh.num_verts = header.num_verts;
+	mesh.index_data = reinterpret_cast<const char*>(aligned_indices.data());
+	mesh.num_tris = header.num_tris;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include "math.h"
+#include "file_io.h"
+#include "bobj.h"
+
+// A non-owning view of a triangle mesh, the vertex positions are stored as
+// packed xyz floats and each triangle is 3 uint64 vertex indices. The indices
+// don't have to be 8 byte aligned, so a view can point straight into a mapped
+// file whose index array starts at any offset
+struct mesh_view {
+	const float *verts = nullptr;
+	size_t num_verts = 0;
+	const char *index_data = nullptr;
+	size_t num_tris = 0;
+
+	mesh_view() = default;
+	mesh_view(const std::vector<float> &verts, const std::vector<uint64_t> &indices);
+
+	// Get the i'th vertex index, vertex v of triangle f is index 3 * f + v
+	uint64_t index(const size_t i) const {
+		uint64_t idx;
+		std::memcpy(&idx, index_data + sizeof(uint64_t) * i, sizeof(idx));
+		return idx;
+	}
+	vec3f vertex(const uint64_t i) const {
+		return vec3f(verts[3 * i], verts[3 * i + 1], verts[3 * i + 2]);
+	}
+	std::array<vec3f, 3> triangle(const size_t f) const {
+		return std::array<vec3f, 3>{vertex(index(3 * f)), vertex(index(3 * f + 1)),
+			vertex(index(3 * f + 2))};
+	}
+	// Get a view of the count triangles starting at triangle begin
+	mesh_view triangles(const size_t begin, const size_t count) const {
+		mesh_view sub = *this;
+		sub.index_data += sizeof(uint64_t) * 3 * begin;
+		sub.num_tris = count;
+		return sub;
+	}
+};
+
+// Compute the bounds of the vertices [begin, end) of the mesh in parallel
+box3f mesh_bounds(const mesh_view &mesh, const size_t begin, const size_t end);
+
+// A .bobj mesh file mapped into memory, either the original format or version 2
+// (see bobj.h). The mesh view points directly into the mapped pages, except when the
+// file uses narrower indices, in which case the indices are widened into a copy, and when the vertices are quantized or the file is
+// compressed, in which case they are decoded. Throws a std::runtime_error if the file is invalid.
+struct bobj_file {
+	mapped_file file;
+	std::vector<uint64_t> aligned_indices;
+	std::vector<float> decoded_verts;
+	// The bounds of the vertices, if stored in the file
+	bool has_bounds = false;
+	box3f bounds;
+	// The number of triangles owned by the brick, which come first. All the
+	// triangles are owned unless the file stores ownership
+	uint64_t num_owned_tris = 0;
+	mesh_view mesh;
+
+	// If in_place is set, files which would be decoded or widened into memory
+	// are rejected before any of their data is read
+	bobj_file(const std::string &fname, const bool in_place = false);
+
+private:
+	void load_v1(const std::string &fname);
+	void load_v2(const std::string &fname, const bool in_place);
+	void load_compressed(const std::string &fname, const bobj_header &header);
+};
+
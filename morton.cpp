@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <atomic>
+#include "tbb/tbb.h"
+#include "morton.h"
+
+// Largest quantized coordinate along each axis
+const float MORTON_AXIS_MAX = (1 << 21) - 1;
+
+// Number of bits sorted in each pass of the radix sort
+const uint32_t RADIX_BITS = 8;
+const size_t RADIX_BUCKETS = size_t(1) << RADIX_BITS;
+// Number of elements counted and scattered by each task of a radix sort pass
+const size_t RADIX_BLOCK_SIZE = 1 << 16;
+
+// Spread the low 21 bits of x out to every third bit
+inline uint64_t spread_bits(uint64_t x) {
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffff;
+	x = (x | x << 16) & 0x1f0000ff0000ff;
+	x = (x | x << 8) & 0x100f00f00f00f00f;
+	x = (x | x << 4) & 0x10c30c30c30c30c3;
+	x = (x | x << 2) & 0x1249249249249249;
+	return x;
+}
+
+uint64_t morton_code(const vec3f &p, const box3f &bounds) {
+	uint64_t code = 0;
+	for (int i = 0; i < 3; ++i) {
+		const float extent = bounds.upper[i] - bounds.lower[i];
+		const float x = extent > 0.f ? (p[i] - bounds.lower[i]) / extent : 0.f;
+		const float q = std::min(std::max(x, 0.f), 1.f) * MORTON_AXIS_MAX;
+		code |= spread_bits(static_cast<uint64_t>(q)) << i;
+	}
+	return code;
+}
+
+void radix_sort(std::vector<uint64_t> &keys, std::vector<uint64_t> &values, const uint32_t key_bits) {
+	const size_t n = keys.size();
+	const size_t nblocks = std::max(size_t(1), (n + RADIX_BLOCK_SIZE - 1) / RADIX_BLOCK_SIZE);
+	std::vector<uint64_t> sorted_keys(n);
+	std::vector<uint64_t> sorted_values(n);
+	// The digit counts of each block, which become the offset to write
+	// the block's next element with that digit to
+	std::vector<size_t> offsets(nblocks * RADIX_BUCKETS);
+	for (uint32_t shift = 0; shift < key_bits; shift += RADIX_BITS) {
+		tbb::parallel_for(size_t(0), nblocks, [&](const size_t b) {
+			size_t *counts = &offsets[b * RADIX_BUCKETS];
+			std::fill(counts, counts + RADIX_BUCKETS, 0);
+			const size_t end = std::min(n, (b + 1) * RADIX_BLOCK_SIZE);
+			for (size_t i = b * RADIX_BLOCK_SIZE; i < end; ++i) {
+				++counts[(keys[i] >> shift) & (RADIX_BUCKETS - 1)];
+			}
+		});
+
+		// Elements are written in digit order, and within a digit in block order
+		// to keep the sort stable
+		size_t offset = 0;
+		bool single_digit = false;
+		for (size_t d = 0; d < RADIX_BUCKETS; ++d) {
+			const size_t digit_begin = offset;
+			for (size_t b = 0; b < nblocks; ++b) {
+				const size_t count = offsets[b * RADIX_BUCKETS + d];
+				offsets[b * RADIX_BUCKETS + d] = offset;
+				offset += count;
+			}
+			single_digit = single_digit || offset - digit_begin == n;
+		}
+		// All the keys have the same digit, so this pass wouldn't move anything
+		if (single_digit) {
+			continue;
+		}
+
+		tbb::parallel_for(size_t(0), nblocks, [&](const size_t b) {
+			size_t *block_offsets = &offsets[b * RADIX_BUCKETS];
+			const size_t end = std::min(n, (b + 1) * RADIX_BLOCK_SIZE);
+			for (size_t i = b * RADIX_BLOCK_SIZE; i < end; ++i) {
+				const size_t j = block_offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+				sorted_keys[j] = keys[i];
+				sorted_values[j] = values[i];
+			}
+		});
+		std::swap(keys, sorted_keys);
+		std::swap(values, sorted_values);
+	}
+}
+
+void morton_order(const mesh_view &mesh, const box3f &bounds, std::vector<float> &verts,
+		std::vector<uint64_t> &indices)
+{
+	const size_t ntris = mesh.num_tris;
+	std::vector<uint64_t> keys(ntris);
+	std::vector<uint64_t> tris(ntris);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, ntris),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t t = r.begin(); t != r.end(); ++t) {
+				const auto tri = mesh.triangle(t);
+				keys[t] = morton_code((tri[0] + tri[1] + tri[2]) * (1.f / 3.f), bounds);
+				tris[t] = t;
+			}
+		});
+	radix_sort(keys, tris, MORTON_BITS);
+
+	// Find the first sorted triangle using each vertex, vertices which aren't
+	// used are marked with ntris so they sort to the end
+	std::vector<std::atomic<uint64_t>> first_use(mesh.num_verts);
+	tbb::parallel_for(size_t(0), mesh.num_verts, [&](const size_t v) {
+		first_use[v].store(ntris, std::memory_order_relaxed);
+	});
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, ntris),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t s = r.begin(); s != r.end(); ++s) {
+				for (size_t i = 0; i < 3; ++i) {
+					std::atomic<uint64_t> &first = first_use[mesh.index(3 * tris[s] + i)];
+					uint64_t prev = first.load(std::memory_order_relaxed);
+					while (s < prev && !first.compare_exchange_weak(prev, s, std::memory_order_relaxed));
+				}
+			}
+		});
+
+	keys.resize(mesh.num_verts);
+	std::vector<uint64_t> vert_order(mesh.num_verts);
+	tbb::parallel_for(size_t(0), mesh.num_verts, [&](const size_t v) {
+		keys[v] = first_use[v].load(std::memory_order_relaxed);
+		vert_order[v] = v;
+	});
+	uint32_t first_use_bits = 1;
+	while (first_use_bits < 64 && (ntris >> first_use_bits) != 0) {
+		++first_use_bits;
+	}
+	radix_sort(keys, vert_order, first_use_bits);
+	const size_t nverts = std::lower_bound(keys.begin(), keys.end(), ntris) - keys.begin();
+
+	// Reuse the keys to map the old vertex IDs to the new ones
+	std::vector<uint64_t> &remap = keys;
+	verts.resize(3 * nverts);
+	tbb::parallel_for(size_t(0), nverts, [&](const size_t v) {
+		remap[vert_order[v]] = v;
+		std::copy(mesh.verts + 3 * vert_order[v], mesh.verts + 3 * vert_order[v] + 3, &verts[3 * v]);
+	});
+	indices.resize(3 * ntris);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, ntris),
+		[&](const tbb::blocked_range<size_t> &r) {
+			for (size_t s = r.begin(); s != r.end(); ++s) {
+				for (size_t i = 0; i < 3; ++i) {
+					indices[3 * s + i] = remap[mesh.index(3 * tris[s] + i)];
+				}
+			}
+		});
+}
+
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "math.h"
+#include "mesh.h"
+
+// Number of bits of the Morton codes, 21 per axis
+const uint32_t MORTON_BITS = 63;
+
+// Compute the Morton code of the point, quantized to 21 bits per axis within the bounds
+uint64_t morton_code(const vec3f &p, const box3f &bounds);
+
+// Sort the keys by their low key_bits bits, moving the values along with them, using
+// a parallel least significant digit radix sort. The sort is stable.
+void radix_sort(std::vector<uint64_t> &keys, std::vector<uint64_t> &values, const uint32_t key_bits);
+
+// Copy the mesh into verts and indices with the triangles sorted by the Morton code
+// of their centroid within the bounds, and the vertices numbered in the order they're
+// first used by the sorted triangles. Nearby triangles and their vertices are then
+// close in memory, so the triangles of each brick are in a few contiguous runs.
+// Vertices not used by any triangle are dropped.
+void morton_order(const mesh_view &mesh, const box3f &bounds, std::vector<float> &verts,
+		std::vector<uint64_t> &indices);
+
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
+#include "tbb/tbb.h"
+#include "file_io.h"
+#include "obj_parser.h"
+
+// Target size of the chunks the file is split into for parsing
+const size_t OBJ_CHUNK_SIZE = 32 << 20;
+
+struct obj_chunk {
+	const char *begin = nullptr;
+	const char *end = nullptr;
+	// Counts of the vertices and triangles in the chunk, and the number
+	// in all chunks before this one
+	size_t num_verts = 0;
+	size_t num_tris = 0;
+	size_t verts_offset = 0;
+	size_t tris_offset = 0;
+	// Bounds of the vertices in the chunk
+	box3f bounds;
+};
+
+inline bool is_space(const char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+inline const char* skip_space(const char *p, const char *end) {
+	while (p != end && is_space(*p)) {
+		++p;
+	}
+	return p;
+}
+// std::from_chars doesn't accept a leading '+', which atof and strtol do
+inline const char* skip_plus(const char *p, const char *end) {
+	return p != end && *p == '+' ? p + 1 : p;
+}
+inline const char* skip_token(const char *p, const char *end) {
+	while (p != end && !is_space(*p)) {
+		++p;
+	}
+	return p;
+}
+
+enum OBJ_RECORD {
+	OBJ_OTHER,
+	OBJ_VERTEX,
+	OBJ_FACE,
+};
+
+// Run the callback for each line of [begin, end), passing the record type and
+// the range of the line following the record's tag
+template<typename F>
+void for_each_record(const char *begin, const char *end, const F &fn) {
+	for (const char *p = begin; p < end;) {
+		const char *line_end = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		if (!line_end) {
+			line_end = end;
+		}
+		p = skip_space(p, line_end);
+		if (line_end - p >= 2 && is_space(p[1])) {
+			if (p[0] == 'v') {
+				fn(OBJ_VERTEX, p + 1, line_end);
+			} else if (p[0] == 'f') {
+				fn(OBJ_FACE, p + 1, line_end);
+			}
+		}
+		p = line_end + 1;
+	}
+}
+
+// Count the vertices referenced by a face record
+size_t count_face_verts(const char *p, const char *end) {
+	size_t n = 0;
+	for (p = skip_space(p, end); p != end; p = skip_space(p, end)) {
+		p = skip_token(p, end);
+		++n;
+	}
+	return n;
+}
+
+void load_obj(const std::string &fname, std::vector<float> &verts, std::vector<uint64_t> &indices,
+		box3f *bounds)
+{
+	const mapped_file file(fname);
+	file.advise(0, file.size(), MADV_SEQUENTIAL);
+	const char *data = file.data();
+	const char *data_end = data + file.size();
+
+	// Split the file into chunks, moving each split forward to the start of a line
+	std::vector<obj_chunk> chunks;
+	for (const char *p = data; p < data_end;) {
+		obj_chunk chunk;
+		chunk.begin = p;
+		chunk.end = std::min(p + OBJ_CHUNK_SIZE, data_end);
+		if (chunk.end != data_end) {
+			const char *nl = static_cast<const char*>(std::memchr(chunk.end, '\n', data_end - chunk.end));
+			chunk.end = nl ? nl + 1 : data_end;
+		}
+		p = chunk.end;
+		chunks.push_back(chunk);
+	}
+
+	// Count the vertices and triangles in each chunk so we know where in the
+	// output arrays the chunks go
+	tbb::parallel_for(size_t(0), chunks.size(), size_t(1),
+		[&](const size_t i) {
+			obj_chunk &chunk = chunks[i];
+			for_each_record(chunk.begin, chunk.end,
+				[&](const OBJ_RECORD type, const char *p, const char *end) {
+					if (type == OBJ_VERTEX) {
+						++chunk.num_verts;
+					} else if (type == OBJ_FACE) {
+						const size_t n = count_face_verts(p, end);
+						if (n < 3) {
+							throw std::runtime_error("Invalid face in " + fname
+									+ ": faces must have at least 3 vertices");
+						}
+						chunk.num_tris += n - 2;
+					}
+				});
+		});
+	size_t num_verts = 0;
+	size_t num_tris = 0;
+	for (auto &chunk : chunks) {
+		chunk.verts_offset = num_verts;
+		chunk.tris_offset = num_tris;
+		num_verts += chunk.num_verts;
+		num_tris += chunk.num_tris;
+	}
+
+	verts.resize(3 * num_verts);
+	indices.resize(3 * num_tris);
+	tbb::parallel_for(size_t(0), chunks.size(), size_t(1),
+		[&](const size_t i) {
+			obj_chunk &chunk = chunks[i];
+			float *out_verts = verts.data() + 3 * chunk.verts_offset;
+			uint64_t *out_indices = indices.data() + 3 * chunk.tris_offset;
+			// Number of vertices defined before the current line, for resolving
+			// relative (negative) face indices
+			size_t verts_seen = chunk.verts_offset;
+			for_each_record(chunk.begin, chunk.end,
+				[&](const OBJ_RECORD type, const char *p, const char *end) {
+					if (type == OBJ_VERTEX) {
+						for (size_t j = 0; j < 3; ++j) {
+							p = skip_plus(skip_space(p, end), end);
+							const auto res = std::from_chars(p, end, *out_verts++);
+							if (res.ec != std::errc()) {
+								throw std::runtime_error("Invalid vertex in " + fname);
+							}
+							p = res.ptr;
+						}
+						chunk.bounds.extend(vec3f(out_verts[-3], out_verts[-2], out_verts[-1]));
+						++verts_seen;
+					} else if (type == OBJ_FACE) {
+						uint64_t first = 0;
+						uint64_t prev = 0;
+						size_t n = 0;
+						for (p = skip_space(p, end); p != end; p = skip_space(p, end), ++n) {
+							// Only the position index is used from v/vt/vn
+							int64_t idx = 0;
+							const auto res = std::from_chars(skip_plus(p, end), end, idx);
+							if (res.ec != std::errc() || idx == 0) {
+								throw std::runtime_error("Invalid face in " + fname);
+							}
+							p = skip_token(res.ptr, end);
+
+							const int64_t resolved = idx > 0 ? idx - 1 : int64_t(verts_seen) + idx;
+							if (resolved < 0 || size_t(resolved) >= num_verts) {
+								throw std::runtime_error("Invalid face in " + fname
+										+ ": vertex index out of bounds");
+							}
+							const uint64_t cur = resolved;
+							if (n == 0) {
+								first = cur;
+							} else if (n >= 2) {
+								*out_indices++ = first;
+								*out_indices++ = prev;
+								*out_indices++ = cur;
+							}
+							prev = cur;
+						}
+					}
+				});
+		});
+
+	if (bounds) {
+		*bounds = box3f();
+		for (const auto &chunk : chunks) {
+			bounds->extend(chunk.bounds);
+		}
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+
+// Load the vertex positions and faces of a text OBJ file directly into flat arrays of
+// xyz floats and triangle indices. The file is mapped and split into chunks at line
+// boundaries, which are parsed in parallel. Only v and f records are read, polygons
+// are triangulated as fans. If bounds is given it's set to the bounds of the vertices,
+// which are found while parsing. Throws a std::runtime_error if the file can't be parsed.
+void load_obj(const std::string &fname, std::vector<float> &verts, std::vector<uint64_t> &indices,
+		box3f *bounds = nullptr);
+
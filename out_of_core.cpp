@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include "tbb/tbb.h"
+#include "file_io.h"
+#include "out_of_core.h"
+
+// A triangle as stored in the spill files, with its vertex positions
+// so bricks can be finalized without going back to the input mesh
+struct spill_triangle {
+	uint64_t ids[3];
+	vec3f verts[3];
+};
+
+// Rough estimates of the memory used per triangle when binning a chunk and
+// when finalizing a brick from its spill file
+const size_t BINNING_BYTES_PER_TRI = 160;
+const size_t FINALIZE_BYTES_PER_TRI = 256;
+const size_t MIN_CHUNK_TRIS = 1 << 16;
+
+std::string spill_file_name(const std::string &dir, const size_t cell) {
+	return dir + "/mesh_gridder_" + std::to_string(getpid()) + "_" + std::to_string(cell) + ".spill";
+}
+
+// Removes the spill files that are left when gridding stops, including when an
+// exception is thrown while binning or finalizing the bricks
+struct spill_file_cleanup {
+	const std::string &dir;
+	std::vector<uint8_t> created;
+
+	spill_file_cleanup(const std::string &dir, const size_t ncells) : dir(dir), created(ncells, 0) {}
+	~spill_file_cleanup() {
+		for (size_t i = 0; i < created.size(); ++i) {
+			if (created[i]) {
+				std::remove(spill_file_name(dir, i).c_str());
+			}
+		}
+	}
+};
+
+void grid_out_of_core(const mesh_view &mesh, const uniform_grid &grid,
+		const out_of_core_options &options,
+		const std::function<void(size_t, const mesh_brick&)> &output_brick,
+		sat_counters *counters)
+{
+	const size_t ncells = grid.num_cells();
+	const size_t chunk_tris = std::max(MIN_CHUNK_TRIS, options.memory_budget / BINNING_BYTES_PER_TRI);
+
+	// Bin each chunk of triangles and append them to the spill files of the cells they touch
+	std::vector<size_t> spill_counts(ncells, 0);
+	spill_file_cleanup cleanup(options.scratch_dir, ncells);
+	for (size_t begin = 0; begin < mesh.num_tris; begin += chunk_tris) {
+		const mesh_view chunk = mesh.triangles(begin, std::min(chunk_tris, mesh.num_tris - begin));
+
+		const std::vector<std::vector<size_t>> cell_tris = bin_triangles(grid, chunk, counters, options.ghost_width);
+		tbb::parallel_for(size_t(0), ncells, size_t(1),
+			[&](const size_t i) {
+				const std::vector<size_t> &tris = cell_tris[i];
+				if (tris.empty()) {
+					return;
+				}
+				std::vector<spill_triangle> records(tris.size());
+				for (size_t t = 0; t < tris.size(); ++t) {
+					for (size_t v = 0; v < 3; ++v) {
+						records[t].ids[v] = chunk.index(3 * tris[t] + v);
+						records[t].verts[v] = chunk.vertex(records[t].ids[v]);
+					}
+				}
+				// Replace any stale file on the first write to a cell's spill file
+				cleanup.created[i] = 1;
+				output_file fout(spill_file_name(options.scratch_dir, i), spill_counts[i] != 0);
+				fout.write(reinterpret_cast<const char*>(records.data()),
+						sizeof(spill_triangle) * records.size());
+				spill_counts[i] += records.size();
+			});
+	}
+
+	// Finalize the bricks in batches of cells whose spilled triangles fit in the budget
+	tbb::enumerable_thread_specific<brick_builder> builders;
+	for (size_t batch_begin = 0; batch_begin < ncells;) {
+		size_t batch_end = batch_begin + 1;
+		size_t batch_bytes = spill_counts[batch_begin] * FINALIZE_BYTES_PER_TRI;
+		while (batch_end < ncells
+				&& batch_bytes + spill_counts[batch_end] * FINALIZE_BYTES_PER_TRI <= options.memory_budget)
+		{
+			batch_bytes += spill_counts[batch_end] * FINALIZE_BYTES_PER_TRI;
+			++batch_end;
+		}
+
+		tbb::parallel_for(batch_begin, batch_end, size_t(1),
+			[&](const size_t i) {
+				brick_builder &builder = builders.local();
+				if (spill_counts[i] == 0) {
+					output_brick(i, mesh_brick());
+					return;
+				}
+				const std::string spill_file = spill_file_name(options.scratch_dir, i);
+				{
+					const mapped_file file(spill_file);
+					const spill_triangle *records = reinterpret_cast<const spill_triangle*>(file.data());
+					centroid_owner owner;
+					if (options.ownership) {
+						owner = [&, i](const vec3f &c) { return grid.cell_containing(c) == i; };
+					}
+					const mesh_brick &brick = builder.build(spill_counts[i],
+						[&](const size_t t, const size_t v) { return records[t].ids[v]; },
+						[&](const size_t t, const size_t v) { return records[t].verts[v]; },
+						options.weld_epsilon, owner);
+					output_brick(i, brick);
+				}
+				std::remove(spill_file.c_str());
+				cleanup.created[i] = 0;
+			});
+		batch_begin = batch_end;
+	}
+}
+
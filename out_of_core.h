@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include "mesh.h"
+#include "grid.h"
+#include "brick.h"
+
+struct out_of_core_options {
+	// Approximate memory budget in bytes for binning and finalizing bricks
+	size_t memory_budget = 0;
+	// Directory to write the per-cell spill files to
+	std::string scratch_dir;
+	float weld_epsilon = -1.f;
+	// Assign each triangle to the cell containing its centroid, see bin_triangles
+	// for the ghost layer
+	bool ownership = false;
+	float ghost_width = 0.f;
+};
+
+// Grid a mesh too large to process in memory. The triangles are binned in chunks
+// sized to fit the memory budget, with each cell's triangles appended to its spill
+// file in the scratch directory. Each brick is then finalized from its spill file
+// and passed to output_brick, with the bricks processed in parallel batches that
+// fit in the budget. Only a single brick larger than the budget will exceed it.
+// The mesh is typically a file mapped in place (see bobj_file), since only the current
+// chunk of triangles and the vertices it references need to be paged in while binning. If counters
+// is passed the exact tests run while binning are added to it.
+void grid_out_of_core(const mesh_view &mesh, const uniform_grid &grid,
+		const out_of_core_options &options,
+		const std::function<void(size_t, const mesh_brick&)> &output_brick,
+		sat_counters *counters = nullptr);
+
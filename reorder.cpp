@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "reorder.h"
+
+const size_t NO_VERTEX = std::numeric_limits<size_t>::max();
+
+// Simulated cache size used by Tipsify
+const size_t TIPSIFY_CACHE_SIZE = 16;
+
+// Parameters of Forsyth's vertex scoring, from "Linear-Speed Vertex Cache Optimisation"
+const size_t FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+const float FORSYTH_LAST_TRI_SCORE = 0.75f;
+const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+const mesh_brick& brick_reorderer::reorder(const mesh_brick &in, const reorder_method method) {
+	brick.clear();
+	tri_order.clear();
+	if (method == reorder_method::FORSYTH) {
+		forsyth(in);
+	} else {
+		tipsify(in, TIPSIFY_CACHE_SIZE);
+	}
+
+	// Move the owned triangles back in front of the ghosts, keeping each in cache order
+	brick.num_owned = in.num_owned;
+	if (in.num_owned < in.num_tris()) {
+		brick.indices.clear();
+		for (const bool owned : {true, false}) {
+			for (const auto &t : tri_order) {
+				if ((t < in.num_owned) == owned) {
+					brick.indices.insert(brick.indices.end(), &in.indices[3 * t], &in.indices[3 * t] + 3);
+				}
+			}
+		}
+	}
+
+	vertex_remap.assign(in.verts.size(), std::numeric_limits<uint64_t>::max());
+	brick.verts.reserve(in.verts.size());
+	for (auto &idx : brick.indices) {
+		if (vertex_remap[idx] == std::numeric_limits<uint64_t>::max()) {
+			vertex_remap[idx] = brick.verts.size();
+			brick.verts.push_back(in.verts[idx]);
+		}
+		idx = vertex_remap[idx];
+	}
+	return brick;
+}
+
+void brick_reorderer::build_adjacency(const mesh_brick &in) {
+	const size_t nverts = in.verts.size();
+	const size_t ntris = in.num_tris();
+	adjacency_offsets.assign(nverts + 1, 0);
+	for (const auto &idx : in.indices) {
+		++adjacency_offsets[idx + 1];
+	}
+	for (size_t v = 0; v < nverts; ++v) {
+		adjacency_offsets[v + 1] += adjacency_offsets[v];
+	}
+	adjacency.resize(in.indices.size());
+	live_tris.assign(nverts, 0);
+	for (size_t t = 0; t < ntris; ++t) {
+		for (size_t i = 0; i < 3; ++i) {
+			const uint64_t v = in.indices[3 * t + i];
+			adjacency[adjacency_offsets[v] + live_tris[v]++] = t;
+		}
+	}
+}
+
+void brick_reorderer::tipsify(const mesh_brick &in, const size_t cache_size) {
+	const size_t nverts = in.verts.size();
+	const size_t ntris = in.num_tris();
+	build_adjacency(in);
+
+	cache_time.assign(nverts, 0);
+	emitted.assign(ntris, 0);
+	dead_end.clear();
+	brick.indices.reserve(in.indices.size());
+	size_t time = cache_size + 1;
+	size_t cursor = 0;
+	size_t fan = nverts > 0 ? 0 : NO_VERTEX;
+	while (fan != NO_VERTEX) {
+		// Emit all the remaining triangles around the fanning vertex
+		candidates.clear();
+		for (size_t a = adjacency_offsets[fan]; a < adjacency_offsets[fan + 1]; ++a) {
+			const size_t t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+			tri_order.push_back(t);
+			for (size_t i = 0; i < 3; ++i) {
+				const uint64_t v = in.indices[3 * t + i];
+				brick.indices.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live_tris[v];
+				if (time - cache_time[v] > cache_size) {
+					cache_time[v] = time++;
+				}
+			}
+		}
+		fan = next_vertex(cache_size, time, cursor);
+	}
+}
+
+size_t brick_reorderer::next_vertex(const size_t cache_size, const size_t time, size_t &cursor) {
+	// Pick the candidate which will still be in the cache after emitting
+	// its triangles and entered the cache the earliest
+	size_t best = NO_VERTEX;
+	size_t best_priority = 0;
+	for (const auto &v : candidates) {
+		if (live_tris[v] == 0) {
+			continue;
+		}
+		const size_t age = time - cache_time[v];
+		const size_t priority = age + 2 * live_tris[v] <= cache_size ? age + 1 : 0;
+		if (best == NO_VERTEX || priority > best_priority) {
+			best = v;
+			best_priority = priority;
+		}
+	}
+	if (best != NO_VERTEX) {
+		return best;
+	}
+	// Otherwise backtrack to recently used vertices, then fall back to
+	// the next vertex in input order with triangles left
+	while (!dead_end.empty()) {
+		const size_t v = dead_end.back();
+		dead_end.pop_back();
+		if (live_tris[v] > 0) {
+			return v;
+		}
+	}
+	for (; cursor < live_tris.size(); ++cursor) {
+		if (live_tris[cursor] > 0) {
+			return cursor;
+		}
+	}
+	return NO_VERTEX;
+}
+
+// Vertex scores by cache position and by the number of triangles left, precomputed
+// for the valences most vertices have
+const size_t FORSYTH_MAX_VALENCE = 32;
+struct forsyth_score_tables {
+	float cache[FORSYTH_CACHE_SIZE];
+	float valence[FORSYTH_MAX_VALENCE];
+
+	forsyth_score_tables() {
+		for (size_t i = 0; i < FORSYTH_CACHE_SIZE; ++i) {
+			if (i < 3) {
+				// The vertices of the last triangle get a fixed score so we don't favor
+				// using the same edge over and over
+				cache[i] = FORSYTH_LAST_TRI_SCORE;
+			} else {
+				const float scale = 1.f / (FORSYTH_CACHE_SIZE - 3);
+				cache[i] = std::pow(1.f - (i - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+			}
+		}
+		for (size_t i = 0; i < FORSYTH_MAX_VALENCE; ++i) {
+			valence[i] = valence_boost(i);
+		}
+	}
+	// Boost vertices with few triangles left so they're finished off
+	static float valence_boost(const uint32_t live_tris) {
+		return FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(live_tris),
+				-FORSYTH_VALENCE_BOOST_POWER);
+	}
+};
+
+// Score a vertex by its position in the simulated LRU cache, or -1 if it isn't
+// cached, and the number of triangles still using it
+float forsyth_vertex_score(const int32_t cache_pos, const uint32_t live_tris) {
+	static const forsyth_score_tables tables;
+	if (live_tris == 0) {
+		return -1.f;
+	}
+	const float score = cache_pos >= 0 ? tables.cache[cache_pos] : 0.f;
+	return score + (live_tris < FORSYTH_MAX_VALENCE ? tables.valence[live_tris]
+			: forsyth_score_tables::valence_boost(live_tris));
+}
+
+void brick_reorderer::remove_adjacent_tri(const size_t v, const size_t t) {
+	// The first live_tris[v] entries of the vertex's adjacency are the triangles left
+	const size_t begin = adjacency_offsets[v];
+	const size_t end = begin + live_tris[v];
+	for (size_t a = begin; a < end; ++a) {
+		if (adjacency[a] == t) {
+			std::swap(adjacency[a], adjacency[end - 1]);
+			--live_tris[v];
+			return;
+		}
+	}
+}
+
+void brick_reorderer::forsyth(const mesh_brick &in) {
+	const size_t nverts = in.verts.size();
+	const size_t ntris = in.num_tris();
+	build_adjacency(in);
+
+	cache_pos.assign(nverts, -1);
+	vertex_score.resize(nverts);
+	for (size_t v = 0; v < nverts; ++v) {
+		vertex_score[v] = forsyth_vertex_score(-1, live_tris[v]);
+	}
+	tri_score.resize(ntris);
+	emitted.assign(ntris, 0);
+	size_t best = NO_VERTEX;
+	for (size_t t = 0; t < ntris; ++t) {
+		tri_score[t] = vertex_score[in.indices[3 * t]] + vertex_score[in.indices[3 * t + 1]]
+			+ vertex_score[in.indices[3 * t + 2]];
+		if (best == NO_VERTEX || tri_score[t] > tri_score[best]) {
+			best = t;
+		}
+	}
+
+	cache.clear();
+	brick.indices.reserve(in.indices.size());
+	size_t cursor = 0;
+	while (best != NO_VERTEX) {
+		emitted[best] = 1;
+		tri_order.push_back(best);
+		const uint64_t *tri = &in.indices[3 * best];
+		brick.indices.insert(brick.indices.end(), tri, tri + 3);
+
+		// Move the triangle's vertices to the front of the cache
+		next_cache.clear();
+		for (size_t i = 0; i < 3; ++i) {
+			remove_adjacent_tri(tri[i], best);
+			if (std::find(next_cache.begin(), next_cache.end(), tri[i]) == next_cache.end()) {
+				next_cache.push_back(tri[i]);
+			}
+		}
+		const size_t num_tri_verts = next_cache.size();
+		for (const auto &v : cache) {
+			if (std::find(next_cache.begin(), next_cache.begin() + num_tri_verts, v)
+					== next_cache.begin() + num_tri_verts)
+			{
+				next_cache.push_back(v);
+			}
+		}
+
+		// Update the scores of the vertices in or just pushed out of the cache and
+		// find the best triangle using them
+		for (size_t i = 0; i < next_cache.size(); ++i) {
+			const size_t v = next_cache[i];
+			cache_pos[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+			vertex_score[v] = forsyth_vertex_score(cache_pos[v], live_tris[v]);
+		}
+		best = NO_VERTEX;
+		for (const auto &v : next_cache) {
+			const size_t begin = adjacency_offsets[v];
+			for (size_t a = begin; a < begin + live_tris[v]; ++a) {
+				const size_t t = adjacency[a];
+				const uint64_t *adj = &in.indices[3 * t];
+				tri_score[t] = vertex_score[adj[0]] + vertex_score[adj[1]] + vertex_score[adj[2]];
+				if (best == NO_VERTEX || tri_score[t] > tri_score[best]) {
+					best = t;
+				}
+			}
+		}
+		if (next_cache.size() > FORSYTH_CACHE_SIZE) {
+			next_cache.resize(FORSYTH_CACHE_SIZE);
+		}
+		std::swap(cache, next_cache);
+
+		// If nothing in the cache has triangles left, continue from the next
+		// triangle in input order which hasn't been emitted
+		if (best == NO_VERTEX) {
+			for (; cursor < ntris && emitted[cursor]; ++cursor);
+			best = cursor < ntris ? cursor : NO_VERTEX;
+		}
+	}
+}
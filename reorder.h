@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "brick.h"
+
+enum class reorder_method {
+	// Tipsify (Sander et al. 2007), fast and close to Forsyth's cache efficiency
+	TIPSIFY,
+	// Forsyth's linear-speed vertex cache optimization, slower but typically gives
+	// slightly fewer cache misses
+	FORSYTH,
+};
+
+// Reorders bricks for locality when rendering and compressing them. The reorderer
+// keeps its scratch space and output brick between bricks, so each thread should
+// reuse its own reorderer
+struct brick_reorderer {
+	mesh_brick brick;
+	// Vertex to triangle adjacency, the triangles using vertex v are
+	// adjacency[adjacency_offsets[v]] up to adjacency[adjacency_offsets[v + 1]]
+	std::vector<size_t> adjacency_offsets;
+	std::vector<size_t> adjacency;
+	std::vector<uint32_t> live_tris;
+	std::vector<size_t> cache_time;
+	std::vector<uint8_t> emitted;
+	std::vector<size_t> dead_end;
+	std::vector<size_t> candidates;
+	std::vector<uint64_t> vertex_remap;
+	std::vector<float> vertex_score;
+	std::vector<float> tri_score;
+	std::vector<int32_t> cache_pos;
+	std::vector<size_t> cache;
+	std::vector<size_t> next_cache;
+	// The source triangle of each reordered triangle
+	std::vector<size_t> tri_order;
+
+	// Reorder the triangles of the brick for vertex cache locality, then number the
+	// vertices in the order they're first used by the reordered triangles so vertex
+	// fetches are also local. The brick's owned triangles are kept before its ghost
+	// triangles. Returns the reordered copy of the brick.
+	const mesh_brick& reorder(const mesh_brick &in, const reorder_method method = reorder_method::TIPSIFY);
+
+private:
+	void build_adjacency(const mesh_brick &in);
+	// Tipsify simulating a cache of cache_size vertices
+	void tipsify(const mesh_brick &in, const size_t cache_size);
+	size_t next_vertex(const size_t cache_size, const size_t time, size_t &cursor);
+	void forsyth(const mesh_brick &in);
+	void remove_adjacent_tri(const size_t v, const size_t t);
+};
+
@@ -0,0 +1,124 @@
+// The SIMD kernel of the batched triangle/box test, written with GCC vector
+// extensions. GCC lowers vector operations the function's target doesn't support
+// before inlining, so the kernel has to be compiled for each target it's used with.
+// math.cpp includes this once per target, inside a namespace and #pragma GCC target,
+// so there's no include guard. It relies on the includes of math.cpp.
+
+template<typename VF>
+inline __attribute__((always_inline)) VF simd_load(const float *p) {
+	VF v;
+	std::memcpy(&v, p, sizeof(VF));
+	return v;
+}
+template<typename VF>
+inline __attribute__((always_inline)) VF simd_min(const VF &a, const VF &b) {
+	return a < b ? a : b;
+}
+template<typename VF>
+inline __attribute__((always_inline)) VF simd_max(const VF &a, const VF &b) {
+	return a > b ? a : b;
+}
+template<typename VF, typename VI>
+inline __attribute__((always_inline)) VF simd_abs(const VF &a) {
+	return (VF)((VI)a & 0x7fffffff);
+}
+// Get the mask of the lanes which are set
+template<typename VF, typename VI>
+inline __attribute__((always_inline)) uint32_t simd_lane_mask(const VI &v) {
+	if constexpr (sizeof(VF) == sizeof(__m256)) {
+		return _mm256_movemask_ps((__m256)v);
+	} else {
+		return _mm512_test_epi32_mask((__m512i)v, (__m512i)v);
+	}
+}
+// Returns the lanes where the projections p0, p1, p2 don't overlap [-r, r]
+template<typename VF, typename VI>
+inline __attribute__((always_inline)) VI simd_separated(const VF &p0, const VF &p1, const VF &p2,
+		const VF &r)
+{
+	return (simd_min(p0, simd_min(p1, p2)) > r) | (simd_max(p0, simd_max(p1, p2)) < -r);
+}
+
+// Test the lanes [offset, offset + width) of the batch, this is the same
+// computation as centered_triangle_box_separation done across lanes
+template<typename VF, typename VI>
+inline __attribute__((always_inline)) uint32_t simd_triangle_box_intersection(
+		const triangle_batch &batch, const size_t offset, const vec3f &bcenter, const vec3f &half_lens,
+		uint32_t *rejects)
+{
+	const VF zero = VF{};
+	const VF hx = zero + half_lens.x;
+	const VF hy = zero + half_lens.y;
+	const VF hz = zero + half_lens.z;
+	VF x[3], y[3], z[3];
+	for (size_t i = 0; i < 3; ++i) {
+		x[i] = simd_load<VF>(&batch.v[i][0][offset]) - bcenter.x;
+		y[i] = simd_load<VF>(&batch.v[i][1][offset]) - bcenter.y;
+		z[i] = simd_load<VF>(&batch.v[i][2][offset]) - bcenter.z;
+	}
+
+	// Bullet 1
+	VI reject = simd_separated<VF, VI>(x[0], x[1], x[2], hx)
+		| simd_separated<VF, VI>(y[0], y[1], y[2], hy)
+		| simd_separated<VF, VI>(z[0], z[1], z[2], hz);
+	// Most candidates are rejected by the cheap tests, so stop once all the
+	// triangles in these lanes are. Lanes past the end of the batch don't count
+	const uint32_t lanes = sizeof(VF) / sizeof(float);
+	const uint32_t lane_mask = ((1u << lanes) - 1) << offset;
+	const uint32_t unused_mask = lane_mask & ~((1u << batch.count) - 1);
+	uint32_t reject_mask = simd_lane_mask<VF, VI>(reject) << offset;
+	if (rejects) {
+		rejects[0] |= reject_mask;
+	}
+	if ((reject_mask | unused_mask) == lane_mask) {
+		if (rejects) {
+			rejects[1] |= reject_mask;
+			rejects[2] |= reject_mask;
+		}
+		return 0;
+	}
+
+	// Bullet 2
+	VF ex[3], ey[3], ez[3];
+	for (size_t i = 0; i < 3; ++i) {
+		ex[i] = x[(i + 1) % 3] - x[i];
+		ey[i] = y[(i + 1) % 3] - y[i];
+		ez[i] = z[(i + 1) % 3] - z[i];
+	}
+	const VF nx = ey[0] * ez[1] - ez[0] * ey[1];
+	const VF ny = ez[0] * ex[1] - ex[0] * ez[1];
+	const VF nz = ex[0] * ey[1] - ey[0] * ex[1];
+	const VF vminx = nx > zero ? -hx - x[0] : hx - x[0];
+	const VF vminy = ny > zero ? -hy - y[0] : hy - y[0];
+	const VF vminz = nz > zero ? -hz - z[0] : hz - z[0];
+	reject |= nx * vminx + ny * vminy + nz * vminz > zero;
+	reject_mask = simd_lane_mask<VF, VI>(reject) << offset;
+	if (rejects) {
+		rejects[1] |= reject_mask;
+	}
+	if ((reject_mask | unused_mask) == lane_mask) {
+		if (rejects) {
+			rejects[2] |= reject_mask;
+		}
+		return 0;
+	}
+
+	// Bullet 3
+	for (size_t i = 0; i < 3; ++i) {
+		const VF aex = simd_abs<VF, VI>(ex[i]);
+		const VF aey = simd_abs<VF, VI>(ey[i]);
+		const VF aez = simd_abs<VF, VI>(ez[i]);
+		reject |= simd_separated<VF, VI>(-ez[i] * y[0] + ey[i] * z[0], -ez[i] * y[1] + ey[i] * z[1],
+				-ez[i] * y[2] + ey[i] * z[2], hy * aez + hz * aey);
+		reject |= simd_separated<VF, VI>(ez[i] * x[0] + -ex[i] * z[0], ez[i] * x[1] + -ex[i] * z[1],
+				ez[i] * x[2] + -ex[i] * z[2], hx * aez + hz * aex);
+		reject |= simd_separated<VF, VI>(-ey[i] * x[0] + ex[i] * y[0], -ey[i] * x[1] + ex[i] * y[1],
+				-ey[i] * x[2] + ex[i] * y[2], hx * aey + hy * aex);
+	}
+
+	reject_mask = simd_lane_mask<VF, VI>(reject) << offset;
+	if (rejects) {
+		rejects[2] |= reject_mask;
+	}
+	return ~reject_mask & lane_mask;
+}
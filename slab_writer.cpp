@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <stdexcept>
+#include "slab_writer.h"
+#include "brick_writer.h"
+
+// Size of the buffer used to append the spilled indices to the output
+const size_t INDEX_COPY_BUFFER_SIZE = size_t(64) * 1024 * 1024;
+
+slab_writer::spill_file_cleanup::~spill_file_cleanup() {
+	if (!fname.empty()) {
+		std::remove(fname.c_str());
+	}
+}
+
+slab_writer::slab_writer(const std::string &outputfile) : outputfile(outputfile) {
+	write_binary = outputfile.size() >= 4 && outputfile.substr(outputfile.size() - 4) == "bobj";
+	if (!write_binary) {
+		fout.open(outputfile.c_str());
+	} else {
+		fout.open(outputfile.c_str(), std::ios::binary);
+		uint64_t header[2] = {0};
+		fout.write(reinterpret_cast<char*>(header), sizeof(header));
+		spill_cleanup.fname = spill_file();
+		index_spill.open(spill_file().c_str(),
+				std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+	}
+	if (!fout || (write_binary && !index_spill)) {
+		throw std::runtime_error("Failed to open " + outputfile);
+	}
+}
+std::string slab_writer::spill_file() const {
+	return outputfile + ".indices";
+}
+void slab_writer::write_slab(const mesh_brick &slab, const std::vector<uint64_t> &vertex_edges,
+		const float slice_z)
+{
+	output_ids.reset(slab.verts.size() + shared_verts.size());
+	for (const auto &v : shared_verts) {
+		bool inserted = false;
+		output_ids.find_or_insert(v.first, v.second, inserted);
+	}
+	next_shared_verts.clear();
+	// Each triangle adds at most four lines to the text before it's flushed
+	obj_text.resize(write_binary ? 0 : OBJ_TEXT_CHUNK_SIZE + 4 * OBJ_MAX_LINE_LENGTH);
+	char *text_begin = obj_text.data();
+	char *text_flush_at = text_begin + OBJ_TEXT_CHUNK_SIZE;
+	char *text = text_begin;
+
+	for (size_t i = 0; i < slab.num_tris(); ++i) {
+		const uint64_t *tri = &slab.indices[3 * i];
+		std::array<uint64_t, 3> tids;
+		for (size_t v = 0; v < 3; ++v) {
+			bool inserted = false;
+			tids[v] = output_ids.find_or_insert(vertex_edges[tri[v]], n_verts_written, inserted);
+			if (!inserted) {
+				continue;
+			}
+			const vec3f &vert = slab.verts[tri[v]];
+			if (!write_binary) {
+				text = format_vertex(text, vert);
+			} else {
+				fout.write(reinterpret_cast<const char*>(&vert), sizeof(vert));
+			}
+			// Only the vertices on the shared slice can be welded to by the next slab
+			if (vert.z == slice_z) {
+				next_shared_verts.emplace_back(vertex_edges[tri[v]], n_verts_written);
+			}
+			++n_verts_written;
+		}
+		if (!write_binary) {
+			text = format_triangle(text, tids.data());
+			if (text >= text_flush_at) {
+				fout.write(text_begin, text - text_begin);
+				text = text_begin;
+			}
+		} else {
+			index_spill.write(reinterpret_cast<char*>(tids.data()), sizeof(uint64_t) * tids.size());
+		}
+		++n_indices_written;
+	}
+	if (!write_binary) {
+		fout.write(text_begin, text - text_begin);
+	}
+	if (!fout) {
+		throw std::runtime_error("Failed to write " + outputfile);
+	}
+	if (write_binary && !index_spill) {
+		throw std::runtime_error("Failed to write " + spill_file());
+	}
+	std::swap(shared_verts, next_shared_verts);
+}
+void slab_writer::finish() {
+	if (write_binary) {
+		// Append the indices after the vertices, then seek back and update the header
+		index_spill.seekg(0);
+		std::vector<char> buf(INDEX_COPY_BUFFER_SIZE);
+		uint64_t bytes_copied = 0;
+		while (index_spill.read(buf.data(), buf.size()) || index_spill.gcount() > 0) {
+			fout.write(buf.data(), index_spill.gcount());
+			bytes_copied += index_spill.gcount();
+		}
+		// Every index written must have been read back, or the header would count
+		// indices the file doesn't hold
+		if (index_spill.bad() || bytes_copied != n_indices_written * 3 * sizeof(uint64_t)) {
+			throw std::runtime_error("Failed to read back the indices from " + spill_file());
+		}
+		index_spill.close();
+
+		fout.seekp(0);
+		fout.write(reinterpret_cast<const char*>(&n_verts_written), sizeof(uint64_t));
+		fout.write(reinterpret_cast<char*>(&n_indices_written), sizeof(uint64_t));
+	}
+	fout.close();
+	if (!fout) {
+		throw std::runtime_error("Failed to write " + outputfile);
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include "brick.h"
+
+// Writes the isosurface a slab at a time, welding the vertices by the id of the grid
+// edge they were made on and writing only the vertices the triangles use. The ids of
+// the vertices the last slab left on its top slice are kept to weld the next slab's
+// vertices on the slice to, so the slabs are stitched together without keeping the
+// whole mesh in memory. OBJ files get each vertex right before the first face using it, formatted
+// like the gridder's OBJ bricks so the floats read back exactly. Binary files
+// need all the vertices first, so the indices are spilled to a scratch file next to
+// the output and appended at the end.
+struct slab_writer {
+	// Removes the index spill file when the writer is destroyed, including when an
+	// exception is thrown while extracting or writing the slabs
+	struct spill_file_cleanup {
+		std::string fname;
+
+		~spill_file_cleanup();
+	};
+
+	std::string outputfile;
+	bool write_binary = false;
+	std::ofstream fout;
+	// Declared before the stream so the file is closed before it's removed
+	spill_file_cleanup spill_cleanup;
+	std::fstream index_spill;
+	std::vector<char> obj_text;
+	uint64_t n_verts_written = 0;
+	uint64_t n_indices_written = 0;
+	vertex_remap_table output_ids;
+	// The (edge id, output id) pairs of the vertices on the last slab's top slice
+	std::vector<std::pair<uint64_t, uint64_t>> shared_verts, next_shared_verts;
+
+	// Open the output file, writing a .bobj file if the name ends in bobj and OBJ
+	// otherwise. Throws a std::runtime_error if the file can't be opened
+	slab_writer(const std::string &outputfile);
+
+	std::string spill_file() const;
+
+	// Write the slab's triangles, where vertex_edges holds the edge id of each of the
+	// slab's vertices. The top slice of the slab is at slice_z. Throws a
+	// std::runtime_error if writing the output or the index spill file failed
+	void write_slab(const mesh_brick &slab, const std::vector<uint64_t> &vertex_edges,
+			const float slice_z);
+
+	// Finish writing the file. Throws a std::runtime_error if writing it failed
+	void finish();
+};
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <iomanip>
+#include <sys/resource.h>
+#include "stats.h"
+
+uint64_t peak_rss_bytes() {
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+	// Linux reports the max RSS in kilobytes
+	return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+// Summary of the triangle counts of the bricks, the empty bricks are
+// counted but not included in the triangle count statistics
+struct brick_summary {
+	uint64_t written = 0;
+	uint64_t empty = 0;
+	uint64_t total_tris = 0;
+	uint64_t min_tris = 0;
+	uint64_t max_tris = 0;
+
+	brick_summary(const std::vector<uint64_t> &brick_tris) {
+		min_tris = std::numeric_limits<uint64_t>::max();
+		for (const auto &n : brick_tris) {
+			if (n == gridder_stats::NOT_WRITTEN) {
+				continue;
+			}
+			if (n == 0) {
+				++empty;
+				continue;
+			}
+			++written;
+			total_tris += n;
+			min_tris = std::min(min_tris, n);
+			max_tris = std::max(max_tris, n);
+		}
+		if (written == 0) {
+			min_tris = 0;
+		}
+	}
+	double mean_tris() const {
+		return written == 0 ? 0.0 : static_cast<double>(total_tris) / written;
+	}
+};
+
+void gridder_stats::print_summary(std::ostream &os) const {
+	const brick_summary bricks(brick_tris);
+	double total_time = 0.0;
+	os << "Stage times:\n";
+	for (const auto &s : stages) {
+		os << "    " << std::left << std::setw(12) << s.first << std::right
+			<< std::fixed << std::setprecision(3) << s.second << "s\n";
+		total_time += s.second;
+	}
+	os << "    " << std::left << std::setw(12) << "total" << std::right
+		<< total_time << "s\n" << std::defaultfloat << std::setprecision(6)
+		<< "Bricks: " << bricks.written << " written, " << bricks.empty << " empty skipped, "
+		<< bricks.total_tris << " triangles (min " << bricks.min_tris
+		<< ", mean " << bricks.mean_tris() << ", max " << bricks.max_tris << ")\n"
+		<< "Triangle/box tests: " << sat.tested << " run, " << sat.untested << " skipped, rejected by"
+		<< " bullet 1: " << sat.rejected[0]
+		<< ", bullet 2: " << sat.rejected[1]
+		<< ", bullet 3: " << sat.rejected[2] << "\n"
+		<< "Bytes written: " << bytes_written << "\n"
+		<< "Peak RSS: " << peak_rss_bytes() / (1024 * 1024) << "MB\n";
+}
+
+void gridder_stats::write_json(std::ostream &os) const {
+	const brick_summary bricks(brick_tris);
+	os << "{\n\t\"vertices\": " << num_verts
+		<< ",\n\t\"triangles\": " << num_tris
+		<< ",\n\t\"grid\": [" << grid_dims.x << ", " << grid_dims.y << ", " << grid_dims.z << "]"
+		<< ",\n\t\"stages\": {";
+	for (size_t i = 0; i < stages.size(); ++i) {
+		os << (i == 0 ? "" : ",") << "\n\t\t\"" << stages[i].first << "\": " << stages[i].second;
+	}
+	os << "\n\t},\n\t\"sat\": {"
+		<< "\n\t\t\"tested\": " << sat.tested
+		<< ",\n\t\t\"untested\": " << sat.untested
+		<< ",\n\t\t\"rejected\": [" << sat.rejected[0] << ", " << sat.rejected[1] << ", "
+		<< sat.rejected[2] << "]"
+		<< "\n\t},\n\t\"bricks\": {"
+		<< "\n\t\t\"written\": " << bricks.written
+		<< ",\n\t\t\"empty\": " << bricks.empty
+		<< ",\n\t\t\"total_triangles\": " << bricks.total_tris
+		<< ",\n\t\t\"min_triangles\": " << bricks.min_tris
+		<< ",\n\t\t\"mean_triangles\": " << bricks.mean_tris()
+		<< ",\n\t\t\"max_triangles\": " << bricks.max_tris
+		<< "\n\t},\n\t\"bytes_written\": " << bytes_written
+		<< ",\n\t\"peak_rss_bytes\": " << peak_rss_bytes()
+		// Bricks written by other processes of a distributed run are null
+		<< ",\n\t\"brick_triangles\": [";
+	for (size_t i = 0; i < brick_tris.size(); ++i) {
+		os << (i == 0 ? "" : ", ");
+		if (brick_tris[i] == NOT_WRITTEN) {
+			os << "null";
+		} else {
+			os << brick_tris[i];
+		}
+	}
+	os << "]\n}\n";
+}
+
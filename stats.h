@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include "math.h"
+
+// Time how long the function takes to run, in seconds
+template<typename F>
+double time_stage(const F &fn) {
+	const auto start = std::chrono::steady_clock::now();
+	fn();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of the process in bytes
+uint64_t peak_rss_bytes();
+
+// Timings and counters collected over a gridder run, reported as a human readable
+// summary and as JSON
+struct gridder_stats {
+	// Marks bricks in brick_tris which weren't written by this process
+	static constexpr uint64_t NOT_WRITTEN = std::numeric_limits<uint64_t>::max();
+
+	uint64_t num_verts = 0;
+	uint64_t num_tris = 0;
+	vec3sz grid_dims;
+	// Wall clock time of each stage in seconds, in the order they were run
+	std::vector<std::pair<std::string, double>> stages;
+	sat_counters sat;
+	// Number of triangles in each brick, indexed by brick id. Empty bricks
+	// aren't written out
+	std::vector<uint64_t> brick_tris;
+	uint64_t bytes_written = 0;
+
+	// Run the function and record its time as the named stage
+	template<typename F>
+	void time(const std::string &stage, const F &fn) {
+		stages.emplace_back(stage, time_stage(fn));
+	}
+
+	void print_summary(std::ostream &os) const;
+	void write_json(std::ostream &os) const;
+};
+
@@ -0,0 +1,139 @@
+#include <cstring>
+#include "stream_codec.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+inline uint32_t zigzag(const uint32_t delta) {
+	return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+}
+inline uint32_t unzigzag(const uint32_t v) {
+	return (v >> 1) ^ (0u - (v & 1));
+}
+inline uint32_t encoded_length(const uint32_t v) {
+	return v < (1u << 8) ? 1 : v < (1u << 16) ? 2 : v < (1u << 24) ? 3 : 4;
+}
+inline size_t control_bytes(const size_t n) {
+	return (n + 3) / 4;
+}
+
+size_t delta_vbyte_max_bytes(const size_t n) {
+	return control_bytes(n) + 4 * n;
+}
+
+size_t delta_vbyte_encode(const uint32_t *values, const size_t n, uint8_t *out) {
+	uint8_t *control = out;
+	uint8_t *data = out + control_bytes(n);
+	std::memset(control, 0, control_bytes(n));
+	uint32_t prev = 0;
+	for (size_t i = 0; i < n; ++i) {
+		const uint32_t v = zigzag(values[i] - prev);
+		prev = values[i];
+		const uint32_t len = encoded_length(v);
+		control[i / 4] |= (len - 1) << (2 * (i % 4));
+		for (uint32_t b = 0; b < len; ++b) {
+			*data++ = static_cast<uint8_t>(v >> (8 * b));
+		}
+	}
+	return data - out;
+}
+
+// Decode the values [begin, n) one at a time, starting from the data pointer
+bool scalar_delta_vbyte_decode(const uint8_t *control, const uint8_t *data, const uint8_t *end,
+		const size_t begin, const size_t n, uint32_t prev, uint32_t *values)
+{
+	for (size_t i = begin; i < n; ++i) {
+		const size_t len = ((control[i / 4] >> (2 * (i % 4))) & 3) + 1;
+		if (static_cast<size_t>(end - data) < len) {
+			return false;
+		}
+		uint32_t v = 0;
+		for (size_t b = 0; b < len; ++b) {
+			v |= static_cast<uint32_t>(data[b]) << (8 * b);
+		}
+		data += len;
+		prev += unzigzag(v);
+		values[i] = prev;
+	}
+	return true;
+}
+
+bool scalar_delta_vbyte_decode(const uint8_t *in, const size_t nbytes, const size_t n, uint32_t *values) {
+	if (nbytes < control_bytes(n)) {
+		return false;
+	}
+	return scalar_delta_vbyte_decode(in, in + control_bytes(n), in + nbytes, 0, n, 0, values);
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+// The shuffle which moves the data bytes of a group of 4 values into 32 bit lanes
+// and the total length of the group, for each control byte
+struct vbyte_tables {
+	alignas(16) uint8_t shuffle[256][16];
+	uint8_t length[256];
+
+	vbyte_tables() {
+		for (size_t c = 0; c < 256; ++c) {
+			uint8_t offset = 0;
+			for (size_t k = 0; k < 4; ++k) {
+				const uint8_t len = ((c >> (2 * k)) & 3) + 1;
+				for (uint8_t b = 0; b < 4; ++b) {
+					// Shuffle indices with the high bit set zero the byte
+					shuffle[c][4 * k + b] = b < len ? offset + b : 0x80;
+				}
+				offset += len;
+			}
+			length[c] = offset;
+		}
+	}
+};
+
+__attribute__((target("ssse3")))
+bool ssse3_delta_vbyte_decode(const uint8_t *in, const size_t nbytes, const size_t n, uint32_t *values) {
+	static const vbyte_tables tables;
+	if (nbytes < control_bytes(n)) {
+		return false;
+	}
+	const uint8_t *control = in;
+	const uint8_t *data = in + control_bytes(n);
+	const uint8_t *end = in + nbytes;
+	const __m128i one = _mm_set1_epi32(1);
+	__m128i prev = _mm_setzero_si128();
+	size_t i = 0;
+	// Each group loads 16 bytes of data, the last few groups are decoded
+	// one value at a time to avoid reading past the end of the stream
+	for (; i + 4 <= n && end - data >= 16; i += 4) {
+		const uint8_t c = control[i / 4];
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+		v = _mm_shuffle_epi8(v, _mm_load_si128(reinterpret_cast<const __m128i*>(tables.shuffle[c])));
+		data += tables.length[c];
+		v = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+		// Prefix sum the deltas within the group and add the last value of the previous one
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+		v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi32(v, prev);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), v);
+		prev = _mm_shuffle_epi32(v, 0xff);
+	}
+	return scalar_delta_vbyte_decode(control, data, end, i, n, i > 0 ? values[i - 1] : 0, values);
+}
+#endif
+
+using delta_vbyte_decode_fn = bool (*)(const uint8_t *, const size_t, const size_t, uint32_t *);
+
+delta_vbyte_decode_fn select_delta_vbyte_decode() {
+#if defined(__GNUC__) && defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		return ssse3_delta_vbyte_decode;
+	}
+#endif
+	return scalar_delta_vbyte_decode;
+}
+
+bool delta_vbyte_decode(const uint8_t *in, const size_t nbytes, const size_t n, uint32_t *values) {
+	static const delta_vbyte_decode_fn decode = select_delta_vbyte_decode();
+	return decode(in, nbytes, n, values);
+}
+
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Delta coding of uint32 streams with Stream VByte (Lemire et al. 2017). Each value
+// is replaced by the zigzag encoded difference from the previous value, wrapping
+// around on overflow, which is then stored in 1 to 4 bytes. The stream is the 2 bit
+// byte lengths of the values packed 4 to a control byte, followed by the data bytes.
+// Streams of values which tend to be close to their predecessor, like the indices
+// of a reordered brick or the components of nearby vertices, encode to 1-2 bytes
+// per value and decode 4 values at a time with a single byte shuffle.
+
+// Upper bound on the size of an encoded stream of n values
+size_t delta_vbyte_max_bytes(const size_t n);
+
+// Encode the n values into out, returns the size of the encoded stream
+size_t delta_vbyte_encode(const uint32_t *values, const size_t n, uint8_t *out);
+
+// Decode n values from the encoded stream of nbytes. Uses an SSSE3 kernel if the CPU
+// supports it. Returns false if the stream is too short to hold n values.
+bool delta_vbyte_decode(const uint8_t *in, const size_t nbytes, const size_t n, uint32_t *values);
+
@@ -0,0 +1,175 @@
+#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "tbb/tbb.h"
+
+#include "grid.h"
+#include "mesh.h"
+#include "brick.h"
+#include "brick_writer.h"
+#include "brick_pack.h"
+
+// Round trips the bricks of a mesh through a pack: each brick is written concurrently
+// into a pack and on its own as the gridder does without -pack, then the pack is read
+// back and every brick's data and entry are compared with the separate output
+
+// A UV sphere with shared vertices, hollow so some cells are empty
+void make_sphere(std::vector<float> &verts, std::vector<uint64_t> &indices, const size_t nrings) {
+	const size_t nsegments = 2 * nrings;
+	for (size_t i = 0; i <= nrings; ++i) {
+		for (size_t j = 0; j < nsegments; ++j) {
+			const float theta = M_PI * i / nrings;
+			const float phi = 2.0 * M_PI * j / nsegments;
+			verts.push_back(0.9f * std::sin(theta) * std::cos(phi));
+			verts.push_back(0.9f * std::sin(theta) * std::sin(phi));
+			verts.push_back(0.9f * std::cos(theta));
+		}
+	}
+	auto vertex = [&](const size_t i, const size_t j) { return i * nsegments + j % nsegments; };
+	for (size_t i = 0; i < nrings; ++i) {
+		for (size_t j = 0; j < nsegments; ++j) {
+			for (const uint64_t v : {vertex(i, j), vertex(i + 1, j), vertex(i, j + 1),
+					vertex(i, j + 1), vertex(i + 1, j), vertex(i + 1, j + 1)})
+			{
+				indices.push_back(v);
+			}
+		}
+	}
+}
+
+// Grid the mesh into a pack and separate files in dir with the writer settings,
+// returns the number of mismatched bricks
+size_t round_trip(const std::string &dir, const std::string &name, const pack_format format,
+		const uniform_grid &grid, const mesh_view &mesh, const brick_writer &settings)
+{
+	const bool binary = format == pack_format::BOBJ;
+	const std::string ext = binary ? ".bobj" : ".obj";
+	const std::string pack_name = dir + "/" + name + ".pack";
+	const std::vector<std::vector<size_t>> cell_tris = bin_triangles(grid, mesh);
+	const size_t ncells = cell_tris.size();
+
+	std::vector<box3f> bounds(ncells);
+	std::vector<uint64_t> num_tris(ncells, 0);
+	{
+		brick_pack_writer pack(pack_name, format, ncells, false);
+		tbb::enumerable_thread_specific<brick_builder> builders;
+		tbb::enumerable_thread_specific<brick_writer> writers;
+		tbb::parallel_for(size_t(0), ncells, size_t(1),
+			[&](const size_t i) {
+				const mesh_brick &brick = builders.local().build(mesh, cell_tris[i], -1.f);
+				bounds[i] = grid.cell_bounds(i);
+				num_tris[i] = brick.num_tris();
+				if (brick.num_tris() == 0) {
+					return;
+				}
+				brick_writer &writer = writers.local();
+				writer.bobj_v2 = settings.bobj_v2;
+				writer.quant_bits = settings.quant_bits;
+				writer.compress = settings.compress;
+				const std::string fname = dir + "/" + name + std::to_string(i) + ext;
+				if (binary) {
+					writer.encode_bobj(brick);
+					pack.write(i, bounds[i], brick.num_tris(), writer.buffer);
+					writer.write_bobj(brick, fname);
+				} else {
+					writer.encode_obj(brick);
+					pack.write(i, bounds[i], brick.num_tris(), writer.buffer);
+					writer.write_obj(brick, fname);
+				}
+			});
+		pack.finish();
+	}
+
+	size_t mismatches = 0;
+	size_t nbricks = 0;
+	const brick_pack pack(pack_name);
+	if (pack.format() != format || pack.num_bricks() != ncells) {
+		std::cout << name << ": pack header doesn't match\n";
+		++mismatches;
+	}
+	for (size_t i = 0; i < std::min(ncells, pack.num_bricks()); ++i) {
+		const pack_entry &e = pack.entry(i);
+		bool match = e.num_tris == num_tris[i];
+		// Empty bricks aren't written, so only their size is set
+		if (num_tris[i] == 0) {
+			match = match && e.size == 0;
+		} else {
+			++nbricks;
+			const box3f b(vec3f(e.lower[0], e.lower[1], e.lower[2]), vec3f(e.upper[0], e.upper[1], e.upper[2]));
+			match = match && b.lower == bounds[i].lower && b.upper == bounds[i].upper;
+			const std::string fname = dir + "/" + name + std::to_string(i) + ext;
+			const mapped_file separate(fname);
+			match = match && e.size == separate.size()
+				&& std::memcmp(pack.brick_data(i), separate.data(), e.size) == 0;
+			std::remove(fname.c_str());
+		}
+		if (!match) {
+			std::cout << name << ": brick " << i << " doesn't match its separate file\n";
+			++mismatches;
+		}
+	}
+	std::remove(pack_name.c_str());
+	std::cout << name << ": " << nbricks << " of " << ncells << " bricks written, "
+		<< mismatches << " mismatches\n";
+	return mismatches;
+}
+
+// Check that a pack whose header has an unknown brick format is rejected
+size_t check_unknown_format(const std::string &dir) {
+	const std::string pack_name = dir + "/unknown_format.pack";
+	{
+		brick_pack_writer pack(pack_name, pack_format::BOBJ, 1, false);
+		pack.finish();
+	}
+	{
+		std::fstream f(pack_name, std::ios::binary | std::ios::in | std::ios::out);
+		const uint32_t format = 7;
+		f.seekp(offsetof(pack_header, format));
+		f.write(reinterpret_cast<const char*>(&format), sizeof(format));
+	}
+	size_t failures = 1;
+	try {
+		const brick_pack pack(pack_name);
+		std::cout << "unknown format: pack was accepted\n";
+	} catch (const std::runtime_error &) {
+		failures = 0;
+	}
+	std::remove(pack_name.c_str());
+	return failures;
+}
+
+int main() {
+	char dir_template[] = "/tmp/brick_pack_testXXXXXX";
+	const char *dir = mkdtemp(dir_template);
+	if (!dir) {
+		std::cout << "Error: failed to create a scratch directory\n";
+		return 1;
+	}
+
+	std::vector<float> verts;
+	std::vector<uint64_t> indices;
+	make_sphere(verts, indices, 96);
+	const mesh_view mesh(verts, indices);
+	const uniform_grid grid(vec3sz(4, 4, 4), box3f(vec3f(-1.f), vec3f(1.f)));
+
+	size_t mismatches = 0;
+	brick_writer settings;
+	mismatches += round_trip(dir, "obj", pack_format::OBJ, grid, mesh, settings);
+	mismatches += round_trip(dir, "bobj", pack_format::BOBJ, grid, mesh, settings);
+	settings.bobj_v2 = true;
+	mismatches += round_trip(dir, "bobj_v2", pack_format::BOBJ, grid, mesh, settings);
+	settings.quant_bits = 12;
+	settings.compress = true;
+	mismatches += round_trip(dir, "bobj_v2_compressed", pack_format::BOBJ, grid, mesh, settings);
+	mismatches += check_unknown_format(dir);
+	rmdir(dir);
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "isosurface.h"
+#include "mesh.h"
+#include "obj_parser.h"
+#include "slab_writer.h"
+
+// Checks that closed isosurfaces extracted a z slab at a time and stitched together by
+// the slab writer are watertight, with every edge shared by exactly two triangles, for
+// any slab size. The OBJ output must read back to exactly the .bobj output. The bricks
+// the gridder extracts straight from the volume must have no degenerate triangles and
+// stitch together into the same watertight surface
+
+const std::array<size_t, 3> DIMS = {37, 41, 43};
+const float CENTER[3] = {18.3f, 20.1f, 21.7f};
+
+// Distance from the center, with a bump so the surfaces aren't just spheres
+float field(const size_t x, const size_t y, const size_t z) {
+	const float dx = x - CENTER[0];
+	const float dy = y - CENTER[1];
+	const float dz = z - CENTER[2];
+	return std::sqrt(dx * dx + dy * dy + dz * dz) + 2.f * std::sin(0.4f * dx) * std::cos(0.3f * dz);
+}
+
+template<typename T>
+std::vector<char> make_volume(const float scale) {
+	std::vector<char> data(DIMS[0] * DIMS[1] * DIMS[2] * sizeof(T));
+	T *voxels = reinterpret_cast<T*>(data.data());
+	for (size_t z = 0; z < DIMS[2]; ++z) {
+		for (size_t y = 0; y < DIMS[1]; ++y) {
+			for (size_t x = 0; x < DIMS[0]; ++x) {
+				const float v = std::min(std::round(scale * field(x, y, z)), float(std::numeric_limits<T>::max()));
+				voxels[(z * DIMS[1] + y) * DIMS[0] + x] = static_cast<T>(v);
+			}
+		}
+	}
+	return data;
+}
+
+// Extract the isosurfaces slab_layers layers of cells at a time into the output
+// file, as isosurface_to_obj does
+void extract_slabs(const std::vector<char> &data, const voxel_type type, const std::vector<float> &isovalues,
+		const size_t slab_layers, const std::string &outputfile)
+{
+	const size_t slice_bytes = DIMS[0] * DIMS[1] * voxel_size(type);
+	const size_t num_layers = DIMS[2] - 1;
+	slab_writer writer(outputfile);
+	mesh_brick isosurface;
+	std::vector<uint64_t> vertex_edges;
+	for (size_t z = 0; z < num_layers; z += slab_layers) {
+		volume_view volume;
+		volume.data = data.data() + z * slice_bytes;
+		volume.type = type;
+		volume.dims = {DIMS[0], DIMS[1], std::min(slab_layers, num_layers - z) + 1};
+		volume.origin = {0, 0, z};
+
+		isosurface.clear();
+		vertex_edges.clear();
+		extract_isosurface(volume, isovalues, isosurface, &vertex_edges);
+		writer.write_slab(isosurface, vertex_edges, z + volume.dims[2] - 1);
+	}
+	writer.finish();
+}
+
+// Count the edges of the mesh not shared by exactly two triangles, and its
+// triangles using a vertex more than once
+size_t count_open_edges(const mesh_view &mesh) {
+	std::unordered_map<uint64_t, size_t> edge_tris;
+	size_t bad = 0;
+	for (size_t t = 0; t < mesh.num_tris; ++t) {
+		const uint64_t tri[3] = {mesh.index(3 * t), mesh.index(3 * t + 1), mesh.index(3 * t + 2)};
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+			++bad;
+			continue;
+		}
+		for (size_t i = 0; i < 3; ++i) {
+			const uint64_t a = std::min(tri[i], tri[(i + 1) % 3]);
+			const uint64_t b = std::max(tri[i], tri[(i + 1) % 3]);
+			++edge_tris[a * mesh.num_verts + b];
+		}
+	}
+	for (const auto &e : edge_tris) {
+		bad += e.second != 2 ? 1 : 0;
+	}
+	return bad;
+}
+
+// Extract the bricks of a grid over the volume as the gridder does for -iso, check that
+// no brick has a triangle using a vertex more than once, and that the bricks joined by
+// the edge ids of their vertices are watertight. Returns the number of failures
+size_t check_bricks(const std::string &name, const std::vector<char> &data, const voxel_type type,
+		const std::vector<float> &isovalues, const vec3sz &grid_dims, const size_t expected_tris)
+{
+	volume_view volume;
+	volume.data = data.data();
+	volume.type = type;
+	volume.dims = DIMS;
+	const volume_grid vgrid(DIMS, grid_dims);
+
+	brick_builder builder;
+	std::vector<uint64_t> joined_indices;
+	size_t repeated = 0;
+	for (size_t i = 0; i < vgrid.num_bricks(); ++i) {
+		std::array<size_t, 3> begin, end;
+		vgrid.brick_cells(i, begin, end);
+		mesh_brick extracted;
+		std::vector<uint64_t> vertex_edges;
+		extract_isosurface(volume, begin, end, isovalues, extracted, &vertex_edges);
+		auto edge_id = [&](const size_t t, const size_t v) {
+			return vertex_edges[extracted.indices[3 * t + v]];
+		};
+		const mesh_brick &brick = builder.build(extracted.num_tris(), edge_id,
+			[&](const size_t t, const size_t v) { return extracted.verts[extracted.indices[3 * t + v]]; },
+			-1.f);
+		for (size_t t = 0; t < brick.num_tris(); ++t) {
+			const uint64_t *tri = &brick.indices[3 * t];
+			repeated += tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0] ? 1 : 0;
+			for (size_t v = 0; v < 3; ++v) {
+				joined_indices.push_back(edge_id(t, v));
+			}
+		}
+	}
+
+	size_t failures = 0;
+	const std::string grid_name = std::to_string(grid_dims.x) + "x" + std::to_string(grid_dims.y)
+		+ "x" + std::to_string(grid_dims.z);
+	if (repeated != 0) {
+		std::cout << name << ": " << repeated << " triangles repeat a vertex in the "
+			<< grid_name << " bricks\n";
+		++failures;
+	}
+	if (joined_indices.size() != 3 * expected_tris) {
+		std::cout << name << ": " << joined_indices.size() / 3 << " triangles in the " << grid_name
+			<< " bricks, expected " << expected_tris << "\n";
+		++failures;
+	}
+	mesh_view joined;
+	joined.index_data = reinterpret_cast<const char*>(joined_indices.data());
+	joined.num_tris = joined_indices.size() / 3;
+	joined.num_verts = joined_indices.empty() ? 0
+		: *std::max_element(joined_indices.begin(), joined_indices.end()) + 1;
+	const size_t open_edges = count_open_edges(joined);
+	if (open_edges != 0) {
+		std::cout << name << ": " << open_edges << " open edges joining the " << grid_name << " bricks\n";
+		++failures;
+	}
+	return failures;
+}
+
+// Extract the surfaces over slabs of each size and check the output, returns the number of failures
+size_t check_volume(const std::string &dir, const std::string &name, const std::vector<char> &data,
+		const voxel_type type, const std::vector<float> &isovalues)
+{
+	size_t failures = 0;
+	size_t expected_tris = 0;
+	for (const size_t slab_layers : {DIMS[2], size_t(1), size_t(2), size_t(5), size_t(16)}) {
+		const std::string prefix = dir + "/" + name + "_" + std::to_string(slab_layers);
+		extract_slabs(data, type, isovalues, slab_layers, prefix + ".bobj");
+		extract_slabs(data, type, isovalues, slab_layers, prefix + ".obj");
+
+		bool ok = true;
+		size_t num_tris = 0;
+		{
+			const bobj_file bobj(prefix + ".bobj");
+			std::vector<float> obj_verts;
+			std::vector<uint64_t> obj_indices;
+			load_obj(prefix + ".obj", obj_verts, obj_indices);
+			num_tris = bobj.mesh.num_tris;
+
+			// Original .bobj files are read in place whatever the alignment of their indices
+			if (!bobj.aligned_indices.empty()) {
+				std::cout << name << ": indices of the " << bobj.mesh.num_verts << " vertex .bobj were copied\n";
+				ok = false;
+			}
+			const size_t open_edges = count_open_edges(bobj.mesh);
+			if (open_edges != 0) {
+				std::cout << name << ": " << open_edges << " open edges with " << slab_layers << " layer slabs\n";
+				ok = false;
+			}
+			const bool same_obj = obj_verts.size() == 3 * bobj.mesh.num_verts
+				&& obj_indices.size() == 3 * bobj.mesh.num_tris
+				&& std::equal(obj_verts.begin(), obj_verts.end(), bobj.mesh.verts)
+				&& std::memcmp(obj_indices.data(), bobj.mesh.index_data, sizeof(uint64_t) * obj_indices.size()) == 0;
+			if (!same_obj) {
+				std::cout << name << ": OBJ output doesn't match the .bobj with " << slab_layers << " layer slabs\n";
+				ok = false;
+			}
+		}
+		// The slab size only changes the order of the triangles
+		if (slab_layers == DIMS[2]) {
+			expected_tris = num_tris;
+			if (num_tris == 0) {
+				std::cout << name << ": no triangles extracted\n";
+				ok = false;
+			}
+		} else if (num_tris != expected_tris) {
+			std::cout << name << ": " << num_tris << " triangles with " << slab_layers
+				<< " layer slabs, expected " << expected_tris << "\n";
+			ok = false;
+		}
+		std::remove((prefix + ".bobj").c_str());
+		std::remove((prefix + ".obj").c_str());
+		failures += ok ? 0 : 1;
+	}
+	for (const vec3sz grid_dims : {vec3sz(2, 2, 2), vec3sz(3, 1, 4)}) {
+		failures += check_bricks(name, data, type, isovalues, grid_dims, expected_tris);
+	}
+	std::cout << name << ": " << expected_tris << " triangles, " << failures << " failures\n";
+	return failures;
+}
+
+int main() {
+	char dir_template[] = "/tmp/isosurface_slabs_testXXXXXX";
+	const char *dir = mkdtemp(dir_template);
+	if (!dir) {
+		std::cout << "Error: failed to create a scratch directory\n";
+		return 1;
+	}
+
+	size_t failures = 0;
+	try {
+		// Nested surfaces, and integer voxels where vertices land exactly on voxels
+		failures += check_volume(dir, "float32", make_volume<float>(1.f), voxel_type::FLOAT32, {6.3f, 12.7f});
+		failures += check_volume(dir, "uint8", make_volume<uint8_t>(8.f), voxel_type::UINT8, {64.f, 120.f});
+	} catch (const std::runtime_error &e) {
+		std::cout << "Error: " << e.what() << std::endl;
+		failures = 1;
+	}
+	rmdir(dir);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <cmath>
+#include <random>
+#include <array>
+#include <vector>
+
+#include "math.h"
+#include "grid.h"
+
+// Checks that every batched SAT kernel the CPU supports gives exactly the same
+// result as the scalar triangle/box test, so the bricks don't depend on the CPU
+
+using triangle = std::array<vec3f, 3>;
+
+// A UV sphere like the benchmark's, whose triangles cross many cell boundaries
+void append_sphere(std::vector<triangle> &tris, const vec3f &center, const float radius,
+		const size_t nrings)
+{
+	const size_t nsegments = 2 * nrings;
+	auto vertex = [&](const size_t i, const size_t j) {
+		const float theta = M_PI * i / nrings;
+		const float phi = 2.0 * M_PI * (j % nsegments) / nsegments;
+		return center + vec3f(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi),
+				std::cos(theta)) * radius;
+	};
+	for (size_t i = 0; i < nrings; ++i) {
+		for (size_t j = 0; j < nsegments; ++j) {
+			tris.push_back(triangle{vertex(i, j), vertex(i + 1, j), vertex(i, j + 1)});
+			tris.push_back(triangle{vertex(i, j + 1), vertex(i + 1, j), vertex(i + 1, j + 1)});
+		}
+	}
+}
+
+// Groups of small random triangles around random points, half of them with their
+// vertices snapped to the cell boundaries so they exactly touch the cells
+void append_random(std::vector<triangle> &tris, const uniform_grid &grid, const size_t ngroups) {
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> pos(0.f, 1.f);
+	std::uniform_real_distribution<float> offset(-1.5f, 1.5f);
+	const vec3f size = grid.bounds.upper - grid.bounds.lower;
+	auto snap = [&](const float x, const int axis) {
+		const float lower = grid.bounds.lower[axis];
+		return lower + std::round((x - lower) / grid.brick_size[axis]) * grid.brick_size[axis];
+	};
+	for (size_t g = 0; g < ngroups; ++g) {
+		const vec3f base = grid.bounds.lower + vec3f(pos(rng), pos(rng), pos(rng)) * size;
+		for (size_t t = 0; t < TRIANGLE_BATCH_SIZE; ++t) {
+			triangle tri;
+			for (auto &p : tri) {
+				p = base + vec3f(offset(rng), offset(rng), offset(rng)) * grid.brick_size;
+				if (t % 2 == 0) {
+					p.x = snap(p.x, 0);
+					p.y = snap(p.y, 1);
+				}
+			}
+			tris.push_back(tri);
+		}
+	}
+}
+
+int main() {
+	const uniform_grid grid(vec3sz(64, 64, 64), box3f(vec3f(-1.f), vec3f(1.f)));
+	// Each run of TRIANGLE_BATCH_SIZE triangles is tested as a batch, so keep them close
+	std::vector<triangle> tris;
+	append_sphere(tris, vec3f(0.f), 0.9f, 128);
+	append_sphere(tris, vec3f(0.013f, -0.021f, 0.007f), 0.37f, 256);
+	append_random(tris, grid, 10000);
+
+	// Test each triangle against every cell its bounds overlap, as binning does
+	std::vector<sat_kernel> kernels;
+	for (const sat_kernel k : {sat_kernel::SCALAR, sat_kernel::AVX2, sat_kernel::AVX512}) {
+		if (sat_kernel_supported(k)) {
+			kernels.push_back(k);
+		}
+	}
+	const char *kernel_names[] = {"scalar", "AVX2", "AVX-512"};
+	std::vector<size_t> mismatches(kernels.size(), 0);
+	size_t ntested = 0;
+	size_t nhits = 0;
+	for (size_t start = 0; start < tris.size(); start += TRIANGLE_BATCH_SIZE) {
+		const size_t end = std::min(start + TRIANGLE_BATCH_SIZE, tris.size());
+		box3f bounds;
+		for (size_t t = start; t < end; ++t) {
+			for (const auto &p : tris[t]) {
+				bounds.extend(p);
+			}
+		}
+		vec3sz lo, hi;
+		grid.overlapped_cells(bounds, lo, hi);
+		for (size_t z = lo.z; z <= hi.z; ++z) {
+			for (size_t y = lo.y; y <= hi.y; ++y) {
+				for (size_t x = lo.x; x <= hi.x; ++x) {
+					const box3f cell = grid.cell_bounds(grid.cell_id(vec3sz(x, y, z)));
+					triangle_batch batch;
+					uint32_t expected = 0;
+					for (size_t t = start; t < end; ++t) {
+						const triangle &tri = tris[t];
+						if (triangle_box_intersection(tri[0], tri[1], tri[2], cell)) {
+							expected |= 1u << batch.count;
+						}
+						batch.push_back(tri[0], tri[1], tri[2]);
+					}
+					for (size_t k = 0; k < kernels.size(); ++k) {
+						const uint32_t mask = triangle_box_intersection(batch, cell, kernels[k]);
+						mismatches[k] += __builtin_popcount(mask ^ expected);
+					}
+					ntested += batch.count;
+					nhits += __builtin_popcount(expected);
+				}
+			}
+		}
+	}
+
+	std::cout << "Tested " << ntested << " triangle/cell pairs, " << nhits << " intersect\n";
+	bool ok = true;
+	for (size_t k = 0; k < kernels.size(); ++k) {
+		std::cout << kernel_names[static_cast<int>(kernels[k])] << " kernel: "
+			<< mismatches[k] << " mismatches\n";
+		ok = ok && mismatches[k] == 0;
+	}
+	return ok ? 0 : 1;
+}